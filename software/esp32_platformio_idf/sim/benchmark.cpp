@@ -0,0 +1,123 @@
+//Host benchmark of the valve positioning on the simulated drive.
+//Each plant runs in its own process because the valve keeps its state in static (rtc) variables.
+//
+//Build and run on Linux from the esp32_platformio_idf directory (-DSIM_LOG prints the valve errors):
+//  c++ -O2 -std=c++11 -Isim/include -Isrc sim/valveSim.cpp sim/benchmark.cpp src/modules/valve.cpp -o valvesim && ./valvesim
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "valveSim.h"
+#include "modules/valve.h"
+
+#define ADJUSTMENTS 200
+#define SEED 4711
+
+//Time for the drive to come to rest after an adjustment in µs
+#define SETTLE_US 500000
+
+struct plant {
+    const char* name;
+    valveSim_params_t params;
+};
+
+//travel, backlash, maxRate, deadband, tauDrive, tauCoast, jitter, noiseRate, missRate, startPosition
+static const plant plants[] = {
+    { "ideal",          { 1200, 0,  400, 15, 0.03, 0.06, 0,   0, 0,     600 } },
+    { "backlash",       { 1200, 12, 400, 15, 0.03, 0.06, 0,   0, 0,     600 } },
+    { "jitter",         { 1200, 12, 400, 15, 0.03, 0.06, 0.6, 0, 0,     600 } },
+    { "noise",          { 1200, 12, 400, 15, 0.03, 0.06, 0.6, 2, 0.002, 600 } },
+    { "slow heavy",     { 1200, 12, 200, 25, 0.08, 0.15, 0.6, 2, 0.002, 600 } },
+};
+
+static double ms(int64_t us) {
+    return us / 1000.0;
+}
+
+//Stem position in percent of the travel
+static double stemPercent(const valveSim_params_t* params) {
+    return 100.0 * valveSim_stats()->stemPosition / params->travel;
+}
+
+static void run(const plant* plant) {
+
+    valveSim_reset( &plant->params, SEED );
+    valve_init();
+
+    /* Calibration */
+
+    valveSim_stats_t before = *valveSim_stats();
+    bool calibrated = valve_calibration();
+    valveSim_stats_t after = *valveSim_stats();
+
+    printf( "%-12s calibration %s: %u/%.0f counts, %.0f ms, motor %.0f ms, %u stalls, latency %.1f/%.1f ms\n",
+        plant->name, calibrated ? "done" : "failed", valve_getMaxCounts(), plant->params.travel,
+        ms( after.time - before.time ), ms( after.motorOnTime - before.motorOnTime ), after.stalls - before.stalls,
+        after.stalls > before.stalls ? ms( after.stallLatencySum - before.stallLatencySum ) / ( after.stalls - before.stalls ) : 0,
+        ms( after.stallLatencyMax ) );
+
+    if( !calibrated )
+        return;
+
+    /* Random adjustments */
+
+    srand( SEED );
+    valveSim_run( SETTLE_US );
+    before = *valveSim_stats();
+
+    uint32_t adjustments = 0;
+    uint32_t failed = 0;
+    double errorSum = 0;
+    double errorMax = 0;
+
+    for( int i = 0; i < ADJUSTMENTS; i++ ) {
+
+        uint16_t permille = rand() % ( VALVE_PERMILLE_MAX + 1 );
+        if( permille == valve_getPermille() )
+            continue;
+
+        adjustments++;
+        if( !valve_setPermille( permille ) )
+            failed++;
+
+        valveSim_run( SETTLE_US );
+
+        //Deviation of the stem from the requested position
+        double error = fabs( stemPercent( &plant->params ) - permille / 10.0 );
+        errorSum += error;
+        if( error > errorMax )
+            errorMax = error;
+    }
+
+    after = *valveSim_stats();
+
+    printf( "%-12s %u adjustments: error %.2f/%.2f %%, %u failed, %.2f moves, motor %.0f ms, %u stalls, latency %.1f/%.1f ms%s\n",
+        plant->name, adjustments, errorSum / adjustments, errorMax, failed,
+        (double) ( after.moves - before.moves ) / adjustments, ms( after.motorOnTime - before.motorOnTime ) / adjustments,
+        after.stalls - before.stalls,
+        after.stalls > before.stalls ? ms( after.stallLatencySum - before.stallLatencySum ) / ( after.stalls - before.stalls ) : 0,
+        ms( after.stallLatencyMax ), valve_calibrationDue() ? ", calibration due" : "" );
+}
+
+int main() {
+
+    printf( "error mean/max, per adjustment: moves and motor on time, stall latency mean/max\n" );
+
+    for( size_t i = 0; i < sizeof(plants) / sizeof(plants[0]); i++ ) {
+
+        fflush( stdout );
+
+        pid_t pid = fork();
+        if( pid == 0 ) {
+            run( &plants[i] );
+            fflush( stdout );
+            _exit( 0 );
+        }
+
+        waitpid( pid, NULL, 0 );
+    }
+
+    return 0;
+}
@@ -0,0 +1,208 @@
+//Host benchmark of the valve curve: loading of the stored table and learning on simulated radiators.
+//Each case runs in its own process because the curve keeps its state in static (rtc) variables.
+//
+//Build and run on Linux from the esp32_platformio_idf directory:
+//  cc -O2 -std=gnu11 -Isim/include -Isrc sim/curveBench.c src/modules/valveCurve.c -lm -o curvebench && ./curvebench
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include "nvs.h"
+#include "board/config.h"
+#include "modules/valve.h"
+#include "modules/valveCurve.h"
+
+#define SEED 4711
+#define CYCLES 3000
+#define CYCLE_S 300 //Wake up period
+#define HEAT_RATE 4.0 //Temperature trend of the full effect in °C/h
+#define LOSS_RATE 2.0 //Temperature trend without heating in °C/h
+#define NOISE_RATE 0.2 //Random temperature trend in °C/h, peak to peak
+#define SENSOR_STEP 0.01 //Resolution of the temperature sensor in °C
+
+//Same layout as the table stored by the valve curve
+typedef struct {
+    uint16_t effect[VALVE_CURVE_POINTS];
+    float gain;
+} storedTable_t;
+
+//Stored tables: a valid one is loaded, all others are replaced by the default
+struct storedCase {
+    const char* name;
+    storedTable_t table;
+    size_t size; //0 = nothing stored
+    uint16_t expected; //Effect at 20% stroke after loading
+};
+
+static const struct storedCase storedCases[] = {
+    { "nothing",        { { 0 }, 0 },                                0,                          360 },
+    { "valid",          { { 0, 300, 500, 700, 900, 1000 }, 3.5f },   sizeof(storedTable_t),      300 },
+    { "other layout",   { { 0, 300, 500, 700, 900, 1000 }, 3.5f },   sizeof(storedTable_t) - 4,  360 },
+    { "first point",    { { 10, 300, 500, 700, 900, 1000 }, 3.5f },  sizeof(storedTable_t),      360 },
+    { "last point",     { { 0, 300, 500, 700, 900, 990 }, 3.5f },    sizeof(storedTable_t),      360 },
+    { "not increasing", { { 0, 300, 300, 700, 900, 1000 }, 3.5f },   sizeof(storedTable_t),      360 },
+    { "gain nan",       { { 0, 300, 500, 700, 900, 1000 }, NAN },    sizeof(storedTable_t),      360 },
+    { "gain negative",  { { 0, 300, 500, 700, 900, 1000 }, -1.0f },  sizeof(storedTable_t),      360 },
+};
+
+//Radiator with the heating effect 1 - (1 - stroke)^exponent, 1 = linear
+struct plant {
+    const char* name;
+    double exponent;
+};
+
+static const struct plant plants[] = {
+    { "linear",       1 },
+    { "quick",        2 },
+    { "very quick",   4 },
+};
+
+/* Nvs with a single blob */
+
+static uint8_t blob[64];
+static size_t blobSize;
+
+esp_err_t nvs_open(const char* name, nvs_open_mode mode, nvs_handle* handle) {
+    *handle = 1;
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle handle, const char* key, void* value, size_t* length) {
+
+    if( blobSize == 0 )
+        return ESP_ERR_NVS_NOT_FOUND;
+
+    *length = blobSize < *length ? blobSize : *length;
+    memcpy( value, blob, *length );
+    *length = blobSize;
+
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle handle, const char* key, const void* value, size_t length) {
+    memcpy( blob, value, length );
+    blobSize = length;
+    return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle handle) {
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle handle) {}
+
+/* Simulated time, replaces the one of the c library for the valve curve */
+
+static time_t now = 1000;
+
+int gettimeofday(struct timeval* tv, void* tz) {
+    tv->tv_sec = now;
+    tv->tv_usec = 0;
+    return 0;
+}
+
+static void runStored(const struct storedCase* c) {
+
+    memcpy( blob, &c->table, sizeof(c->table) );
+    blobSize = c->size;
+
+    valveCurve_init();
+    uint16_t effect = valveCurve_toEffect( 200 );
+
+    printf( "stored %-15s effect at 20%%: %4u, %s\n", c->name, effect, effect == c->expected ? "ok" : "FAILED" );
+}
+
+static double plantEffect(const struct plant* plant, uint16_t stroke) {
+    return 1 - pow( 1 - stroke / (double) VALVE_PERMILLE_MAX, plant->exponent );
+}
+
+//Deviation of the table from the plant in 0.1% steps, mean and max over the stroke
+static void deviation(const struct plant* plant, double* mean, double* max) {
+
+    int points = 0;
+    *mean = 0;
+    *max = 0;
+
+    for( uint16_t stroke = 0; stroke <= VALVE_PERMILLE_MAX; stroke += 50 ) {
+
+        double error = fabs( valveCurve_toEffect( stroke ) - VALVE_PERMILLE_MAX * plantEffect( plant, stroke ) );
+
+        *mean += error;
+        if( error > *max )
+            *max = error;
+        points++;
+    }
+
+    *mean /= points;
+}
+
+static void runPlant(const struct plant* plant) {
+
+    double mean, max;
+
+    valveCurve_init();
+    deviation( plant, &mean, &max );
+    printf( "%-12s default %5.1f/%5.1f %%", plant->name, mean / 10, max / 10 );
+
+    srand( SEED );
+    double temperature = 20;
+    uint16_t stroke = 0;
+
+    for( int i = 0; i < CYCLES; i++ ) {
+
+        //Move the valve every second cycle, so each move is between two intervals of constant stroke
+        if( i % 2 == 0 )
+            stroke = rand() % ( VALVE_PERMILLE_MAX + 1 );
+
+        valveCurve_observe( round( temperature / SENSOR_STEP ) * SENSOR_STEP, stroke );
+
+        double noise = ( rand() / (double) RAND_MAX - 0.5 ) * NOISE_RATE;
+        temperature += ( HEAT_RATE * plantEffect( plant, stroke ) - LOSS_RATE + noise ) * CYCLE_S / 3600;
+        now += CYCLE_S;
+    }
+
+    deviation( plant, &mean, &max );
+    printf( ", after %d cycles %5.1f/%5.1f %%\n", CYCLES, mean / 10, max / 10 );
+}
+
+//Run a case in a child process with fresh static variables
+static void fork_run(void (*run)(const void*), const void* arg) {
+
+    fflush( stdout );
+
+    pid_t pid = fork();
+    if( pid == 0 ) {
+        run( arg );
+        fflush( stdout );
+        _exit( 0 );
+    }
+
+    waitpid( pid, NULL, 0 );
+}
+
+static void runStoredCase(const void* arg) {
+    runStored( (const struct storedCase*) arg );
+}
+
+static void runPlantCase(const void* arg) {
+    runPlant( (const struct plant*) arg );
+}
+
+int main() {
+
+    for( size_t i = 0; i < sizeof(storedCases) / sizeof(storedCases[0]); i++ )
+        fork_run( runStoredCase, &storedCases[i] );
+
+    printf( "deviation of the table from the radiator mean/max\n" );
+
+    for( size_t i = 0; i < sizeof(plants) / sizeof(plants[0]); i++ )
+        fork_run( runPlantCase, &plants[i] );
+
+    return 0;
+}
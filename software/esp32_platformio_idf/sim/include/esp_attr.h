@@ -0,0 +1,8 @@
+//Host replacement of the esp-idf attributes for the valve simulator
+#ifndef ESP_ATTR_H
+#define ESP_ATTR_H
+
+#define IRAM_ATTR
+#define RTC_DATA_ATTR
+
+#endif //ESP_ATTR_H
@@ -0,0 +1,18 @@
+//Host replacement of the esp-idf log for the valve simulator, errors and warnings only with SIM_LOG
+#ifndef ESP_LOG_H
+#define ESP_LOG_H
+
+#include <stdio.h>
+
+#ifdef SIM_LOG
+#define ESP_LOGE( tag, format, ... ) fprintf( stderr, "E (%s) " format "\n", tag, ##__VA_ARGS__ )
+#define ESP_LOGW( tag, format, ... ) fprintf( stderr, "W (%s) " format "\n", tag, ##__VA_ARGS__ )
+#else
+#define ESP_LOGE( tag, format, ... ) do {} while( 0 )
+#define ESP_LOGW( tag, format, ... ) do {} while( 0 )
+#endif
+
+#define ESP_LOGI( tag, format, ... ) do {} while( 0 )
+#define ESP_LOGD( tag, format, ... ) do {} while( 0 )
+
+#endif //ESP_LOG_H
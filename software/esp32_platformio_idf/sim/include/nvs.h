@@ -0,0 +1,32 @@
+//Host replacement of the esp-idf nvs for the valve curve benchmark, a single blob kept in memory
+#ifndef NVS_H
+#define NVS_H
+
+#include <stddef.h>
+
+typedef int esp_err_t;
+typedef int nvs_handle;
+
+typedef enum {
+    NVS_READONLY,
+    NVS_READWRITE
+} nvs_open_mode;
+
+#define ESP_OK 0
+#define ESP_ERR_NVS_NOT_FOUND 0x1102
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+esp_err_t nvs_open(const char* name, nvs_open_mode mode, nvs_handle* handle);
+esp_err_t nvs_get_blob(nvs_handle handle, const char* key, void* value, size_t* length);
+esp_err_t nvs_set_blob(nvs_handle handle, const char* key, const void* value, size_t length);
+esp_err_t nvs_commit(nvs_handle handle);
+void nvs_close(nvs_handle handle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //NVS_H
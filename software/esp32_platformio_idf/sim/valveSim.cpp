@@ -0,0 +1,353 @@
+#include "valveSim.h"
+#include <math.h>
+#include <string.h>
+#include "board/config.h"
+#include "modules/valveHal.h"
+
+//Simulation step in µs
+#define SIM_STEP_US 20
+
+#define SIM_MAX_TIMERS 4
+#define SIM_MAX_LOCKS 2
+
+static valveSim_params_t p;
+static valveSim_stats_t stats;
+static uint32_t rng;
+
+//Motor driver and drive
+static bool awake;
+static uint8_t direction;
+static uint8_t duty;
+static double omega; //Motor speed in counts/s
+static double motorPosition; //Motor side of the gear in counts
+static int64_t blockedSince;
+
+//Reflex encoder, the next edge in the moving direction
+static bool reflex;
+static int edgeDirection;
+static double nextEdge;
+static double edgeOffset;
+
+//Position and milestone counter
+static bool counting;
+static bool targetEnabled;
+static int16_t count;
+static int16_t target;
+static int16_t milestoneCount;
+static valveHal_isr_t onTarget;
+static valveHal_isr_t onMilestone;
+
+struct simTimer {
+    valveHal_timerCallback_t callback;
+    void* arg;
+    bool active;
+    int64_t next;
+    int64_t period;
+};
+
+struct simLock {
+    bool given;
+};
+
+static simTimer timers[SIM_MAX_TIMERS];
+static int timerCount;
+static simLock locks[SIM_MAX_LOCKS];
+static int lockCount;
+
+//Uniform random number in [0, 1)
+static double uniform() {
+    rng = rng * 1664525u + 1013904223u;
+    return ( rng >> 8 ) / 16777216.0;
+}
+
+//Edge of the reflex signal, counted by both units like the pcnt
+static void count_edge() {
+
+    if( !counting || !reflex )
+        return;
+
+    count++;
+
+    if( ++milestoneCount >= VALVE_STALL_PULSES ) {
+        milestoneCount = 0;
+        onMilestone();
+    }
+
+    if( targetEnabled && count == target )
+        onTarget();
+}
+
+//Count the encoder edges passed between two motor positions
+static void encoder(double from, double to) {
+
+    int dir = to > from ? 1 : ( to < from ? -1 : 0 );
+    if( dir == 0 )
+        return;
+
+    //Reversed -> Next edge on the other side
+    if( dir != edgeDirection ) {
+        edgeDirection = dir;
+        nextEdge = dir > 0 ? floor( from ) + 1 : ceil( from ) - 1;
+        edgeOffset = ( uniform() - 0.5 ) * p.jitter;
+    }
+
+    while( dir > 0 ? to >= nextEdge + edgeOffset : to <= nextEdge + edgeOffset ) {
+
+        if( uniform() >= p.missRate )
+            count_edge();
+
+        nextEdge += dir;
+        edgeOffset = ( uniform() - 0.5 ) * p.jitter;
+    }
+}
+
+static void step() {
+
+    double dt = SIM_STEP_US / 1e6;
+
+    //Speed set by the duty, motor accelerates with its time constant and coasts when the bridge sleeps
+    double driveSpeed = 0;
+    if( awake && duty > p.deadband )
+        driveSpeed = ( direction ? 1 : -1 ) * p.maxRate * ( duty - p.deadband ) / ( 100 - p.deadband );
+
+    omega += ( driveSpeed - omega ) * dt / ( awake ? p.tauDrive : p.tauCoast );
+
+    //Stem follows the motor after the backlash is taken up
+    double position = motorPosition + omega * dt;
+    double half = p.backlash / 2;
+    double stem = stats.stemPosition;
+
+    if( position - stem > half )
+        stem = position - half;
+    else if( stem - position > half )
+        stem = position + half;
+
+    //Endstops block stem and motor
+    bool blocked = false;
+    if( stem > p.travel ) {
+        stem = p.travel;
+        position = stem + half;
+        blocked = true;
+    } else if( stem < 0 ) {
+        stem = 0;
+        position = -half;
+        blocked = true;
+    }
+
+    if( blocked )
+        omega = 0;
+
+    stats.stemPosition = stem;
+
+    encoder( motorPosition, position );
+    motorPosition = position;
+
+    //Motor pushes against an endstop
+    if( blocked && driveSpeed != 0 ) {
+        if( blockedSince < 0 )
+            blockedSince = stats.time;
+    } else if( !blocked ) {
+        blockedSince = -1;
+    }
+
+    if( awake && duty > 0 )
+        stats.motorOnTime += SIM_STEP_US;
+
+    //Spurious edges, e.g. ambient light
+    if( reflex && uniform() < p.noiseRate * dt )
+        count_edge();
+
+    stats.time += SIM_STEP_US;
+
+    //Call due timers
+    for( int i = 0; i < timerCount; i++ ) {
+
+        simTimer* timer = &timers[i];
+
+        if( !timer->active || timer->next > stats.time )
+            continue;
+
+        if( timer->period > 0 )
+            timer->next += timer->period;
+        else
+            timer->active = false;
+
+        timer->callback( timer->arg );
+    }
+}
+
+void valveSim_reset(const valveSim_params_t* params, uint32_t seed) {
+
+    p = *params;
+    rng = seed;
+
+    memset( &stats, 0, sizeof(stats) );
+    stats.stemPosition = p.startPosition;
+
+    awake = false;
+    direction = 0;
+    duty = 0;
+    omega = 0;
+    motorPosition = p.startPosition;
+    blockedSince = -1;
+
+    reflex = false;
+    edgeDirection = 0;
+
+    counting = false;
+    targetEnabled = false;
+    count = 0;
+
+    timerCount = 0;
+    lockCount = 0;
+}
+
+const valveSim_stats_t* valveSim_stats() {
+    return &stats;
+}
+
+void valveSim_run(int64_t us) {
+
+    int64_t end = stats.time + us;
+
+    while( stats.time < end )
+        step();
+}
+
+/* Valve hal on the simulated drive */
+
+void valveHal_counterInit(valveHal_isr_t targetIsr, valveHal_isr_t milestoneIsr) {
+    onTarget = targetIsr;
+    onMilestone = milestoneIsr;
+}
+
+void valveHal_counterStart(int16_t targetCounts) {
+    target = targetCounts;
+    targetEnabled = targetCounts > 0;
+    count = 0;
+    milestoneCount = 0;
+    counting = true;
+}
+
+void valveHal_counterStop() {
+    counting = false;
+    targetEnabled = false;
+}
+
+void valveHal_counterDisarm() {
+    targetEnabled = false;
+}
+
+int16_t valveHal_counterGet() {
+    return count;
+}
+
+void valveHal_motorInit() {}
+
+void valveHal_motorStart(uint8_t dir, uint8_t speed) {
+    awake = true;
+    direction = dir;
+    duty = speed;
+    stats.moves++;
+}
+
+void valveHal_motorSpeed(uint8_t speed) {
+    duty = speed;
+}
+
+void valveHal_motorStop() {
+
+    awake = false;
+    direction = 0;
+
+    //Stopped while blocked -> Stall detection latency
+    if( blockedSince >= 0 ) {
+        int64_t latency = stats.time - blockedSince;
+        stats.stalls++;
+        stats.stallLatencySum += latency;
+        if( latency > stats.stallLatencyMax )
+            stats.stallLatencyMax = latency;
+        blockedSince = -1;
+    }
+}
+
+void valveHal_reflexEnable(bool enable) {
+    reflex = enable;
+}
+
+int64_t valveHal_time() {
+    return stats.time;
+}
+
+valveHal_timer_t valveHal_timerCreate(valveHal_timerCallback_t callback, void* arg, const char* name) {
+
+    if( timerCount == SIM_MAX_TIMERS )
+        return NULL;
+
+    simTimer* timer = &timers[timerCount++];
+    timer->callback = callback;
+    timer->arg = arg;
+    timer->active = false;
+
+    return timer;
+}
+
+void valveHal_timerOnce(valveHal_timer_t timer, uint64_t us) {
+
+    simTimer* t = (simTimer*) timer;
+    t->active = true;
+    t->next = stats.time + us;
+    t->period = 0;
+}
+
+void valveHal_timerPeriodic(valveHal_timer_t timer, uint64_t us) {
+
+    simTimer* t = (simTimer*) timer;
+    t->active = true;
+    t->next = stats.time + us;
+    t->period = us;
+}
+
+void valveHal_timerStop(valveHal_timer_t timer) {
+    ( (simTimer*) timer )->active = false;
+}
+
+valveHal_lock_t valveHal_lockCreate() {
+
+    if( lockCount == SIM_MAX_LOCKS )
+        return NULL;
+
+    simLock* lock = &locks[lockCount++];
+    lock->given = true;
+
+    return lock;
+}
+
+//Run the simulation till the lock is given or the timeout has passed
+bool valveHal_lockTake(valveHal_lock_t lock, uint32_t timeoutMs) {
+
+    simLock* l = (simLock*) lock;
+    int64_t deadline = stats.time + timeoutMs * 1000LL;
+
+    while( !l->given && stats.time < deadline )
+        step();
+
+    if( !l->given )
+        return false;
+
+    l->given = false;
+
+    return true;
+}
+
+void valveHal_lockGive(valveHal_lock_t lock) {
+    ( (simLock*) lock )->given = true;
+}
+
+void valveHal_lockGiveFromIsr(valveHal_lock_t lock) {
+    ( (simLock*) lock )->given = true;
+}
+
+void valveHal_delay(uint32_t ms) {
+    valveSim_run( ms * 1000LL );
+}
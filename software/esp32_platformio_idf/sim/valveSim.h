@@ -0,0 +1,47 @@
+#ifndef VALVESIM_H
+#define VALVESIM_H
+
+#include <stdint.h>
+
+/* Simulated valve drive for the host: motor with inertia, gear backlash, valve stem with endstops and the reflex encoder.
+
+Implements the valve hal on simulated time. Waiting for a lock or a delay advances the simulation, timers and counter
+events are called like on the device but without concurrency.
+
+*/
+
+//Physical parameters of the drive
+typedef struct {
+    double travel; //Stem travel between the endstops in counts
+    double backlash; //Gear play between motor and stem in counts
+    double maxRate; //Motor speed at full duty in counts/s
+    double deadband; //Duty in percent which does not turn the motor
+    double tauDrive; //Time constant of the motor speed while driven in s
+    double tauCoast; //Time constant of the motor speed after stop in s
+    double jitter; //Random deviation of the encoder edge spacing, fraction of a count
+    double noiseRate; //Spurious encoder counts per second while the reflex source is on
+    double missRate; //Fraction of encoder edges which are not counted
+    double startPosition; //Stem position at power up in counts
+} valveSim_params_t;
+
+//Measurements of the simulation
+typedef struct {
+    int64_t time; //Simulated time in µs
+    double stemPosition; //Stem position in counts
+    uint32_t moves; //Motor starts
+    int64_t motorOnTime; //Time with the motor driven in µs
+    uint32_t stalls; //Motor stops while blocked at an endstop
+    int64_t stallLatencySum; //Time from blocking to stop in µs
+    int64_t stallLatencyMax;
+} valveSim_stats_t;
+
+//Reset simulation with the given drive and random seed
+void valveSim_reset(const valveSim_params_t* params, uint32_t seed);
+
+//Current measurements
+const valveSim_stats_t* valveSim_stats();
+
+//Advance the simulation
+void valveSim_run(int64_t us);
+
+#endif //VALVESIM_H
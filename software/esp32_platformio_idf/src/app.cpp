@@ -14,6 +14,7 @@
 #include "driver/si7020.h"
 #include "modules/wlan.h"
 #include "modules/valve.h"
+#include "modules/sleepScheduler.h"
 #include "services/mdnsService.h"
 #include "tasks/mqttClient.h"
 #include "tasks/heatCtrl.h"
@@ -35,12 +36,29 @@ EventGroupHandle_t wifi_event_group = NULL;
 
     board_init();
 
+    /* Sleep scheduler */
+    ESP_LOGD( "SYS", "Sleep scheduler init" );
+
+    sleepScheduler_init();
+
     /* Temperature and Humidity Sensor Test*/
     ESP_LOGD( "SYS", "I2C Init" );
 
     //ESP32 I²C module init
     i2c_init();
 
+#if RADIOLESS_CYCLE
+    //Go back to sleep without any network if nothing has to be reported
+    if( !heatController_needsNetwork() ) {
+
+        //Radio stays off -> Time for a due full stroke of the valve
+        heatController_maintenance( false );
+
+        sleepScheduler_reason_t reason;
+        sleepScheduler_sleep( sleepScheduler_next( &reason ) );
+    }
+#endif
+
     ESP_LOGD("SYS", "Pre-Task init" );
 
     /* WiFi */
@@ -53,6 +71,20 @@ EventGroupHandle_t wifi_event_group = NULL;
         ESP_LOGE("SYS", "Wifi event group creation failed" );
     }
 
+    //Create event group for mqtt state, the heat controller waits for the connection
+    mqtt_event_group = xEventGroupCreate();
+
+    if( mqtt_event_group == NULL ) {
+        ESP_LOGE("SYS", "MQTT event group creation failed" );
+    }
+
+    /* Heat controller */
+    ESP_LOGD( "SYS", "Heat controller creation" );
+
+    //Start first, so sensing and valve movement run while wifi is associating
+    TaskHandle_t heatController = NULL;
+    xTaskCreatePinnedToCore( heatController_task, "heatCtrl", 4096, xTaskGetCurrentTaskHandle(), tskIDLE_PRIORITY+1, &heatController, 0);
+
     wlan_init();
     
     /* mDNS Service */
@@ -61,17 +93,12 @@ EventGroupHandle_t wifi_event_group = NULL;
     MDNSService mdnsService;
     mdnsService.start();
 
-    /* Heat controller */
-    ESP_LOGD( "SYS", "Heat controller creation" );
-
-    TaskHandle_t heatController = NULL;
-    xTaskCreatePinnedToCore( heatController_task, "heatCtrl", 4096, xTaskGetCurrentTaskHandle(), tskIDLE_PRIORITY+1, &heatController, 0);
-
     /* MQTT Client */
     ESP_LOGD( "SYS", "MQTT Client init" );
 
     mqttClient_init( MQTT_BROKER, MQTT_PORT, MQTT_USERNAME, MQTT_PASSWORD, MQTT_PUBLICATION_PREFIX, MQTT_SUBSCRIPTION_PREFIX );
     xTaskCreate( mqttClient_task, "MQTT", 4096, NULL, tskIDLE_PRIORITY+10, NULL );
+    xTaskCreate( mqttClient_publisherTask, "MQTTPub", 4096, NULL, tskIDLE_PRIORITY+5, NULL );
     
     ESP_LOGD("SYS", "System startup done");
     
@@ -86,16 +113,24 @@ EventGroupHandle_t wifi_event_group = NULL;
         //Wait for end of heat controlling and the sleep
         if( ulTaskNotifyTake( pdTRUE, DELAY_MS(1000) ) > 0 ) {
 
+            //Get next wake up period from current state and publish the decision
+            sleepScheduler_reason_t reason;
+            uint32_t period = sleepScheduler_next( &reason );
+            mqttClient_pubSleep( period, sleepScheduler_reasonName( reason ) );
+
+            //Values are published by the publisher task, send them before the radio goes down
+            if( !mqttClient_flush( MQTT_FLUSH_TIMEOUT_MS ) ) {
+                ESP_LOGW( "SYS", "Not all values published before sleep" );
+            }
+
             //Set wlan to sleep
             wlan_sleep();
 
-            //keep RTC RAM powered during deep sleep
-            esp_sleep_pd_config( ESP_PD_DOMAIN_RTC_SLOW_MEM, ESP_PD_OPTION_ON );
-        
-            ESP_LOGD( "SYS", "Enter deep sleep");
+            //A due full stroke that waited too long for a cycle without network
+            heatController_maintenance( true );
 
-            //Deep sleep for 50 Seconds (50 * 10^6 µs)
-            esp_deep_sleep( 50 * 1E6 );
+            //Deep sleep till next period or button press
+            sleepScheduler_sleep( period );
         }
 
     }
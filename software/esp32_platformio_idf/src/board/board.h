@@ -36,6 +36,9 @@
 #define UART_TX 1
 #define UART_RX 3
 
+//Userbutton level which wakes up from deep sleep (buttons are active low)
+#define BUTTON_WAKEUP_LEVEL 0
+
 /* Peripheral defines */
 //Temperature and humidity sensot (SI7020)
 #define SI7020_ADDR 0x40
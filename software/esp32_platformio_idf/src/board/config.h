@@ -8,6 +8,9 @@ extern "C" {
 /* Wifi default Settings */
 #define WIFI_SSID "SSID" //WiFI SSID
 #define WIFI_PASSWORD "PASSWORD" //Wifi password
+#define WIFI_FAST_RESUME 1 //1 = Reuse BSSID, channel and IP lease of the last wake cycle, 0 = Full scan and DHCP on every wake
+#define WIFI_FAST_RESUME_TIMEOUT_MS 3000 //Drop the cached lease if no broker connection is possible within this time
+#define WIFI_FALLBACK_TIMEOUT_MS 8000 //Time for scan, association, dhcp (2.3-5.8 s) and broker connection without cached lease
 
 /* MQTT Settings */
 #define MQTT_BROKER  "192.168.0.4"
@@ -16,6 +19,49 @@ extern "C" {
 #define MQTT_PASSWORD  ""
 #define MQTT_SUBSCRIPTION_PREFIX  "max32/cmd/"
 #define MQTT_PUBLICATION_PREFIX  "max32/status/"
+#define MQTT_PERSISTENT_SESSION 1 //1 = Keep session and subscription on the broker between wake cycles, commands (target temperature, config) must be published at QoS >= 1 to be queued. 0 = Clean session, subscribe on every wake up
+#define MQTT_FLUSH_TIMEOUT_MS 1000 //Max. time to publish the queued values before deep sleep
+
+/* Radio-less cycle settings */
+#define RADIOLESS_CYCLE 1 //1 = Skip network when nothing has to be reported, 0 = Network on every wake up
+#define RADIOLESS_DEADBAND 0.2f //Temperature change in °C to the last published value which forces a network cycle
+#define RADIOLESS_MAX_SILENT_CYCLES 10 //Max. count of wake cycles without network
+#define RADIOLESS_CALIBRATION_BACKOFF 6 //A failed calibration is retried after 2, 4, ... up to 2^this cycles
+#define RADIOLESS_CALIBRATION_MAX_DEFER 20 //Max. network cycles a due calibration waits for a cycle without network, then it runs after the network cycle
+
+/* Heat controller settings */
+#define HEATCTRL_CONNECT_TIMEOUT_MS ( WIFI_FAST_RESUME_TIMEOUT_MS + WIFI_FALLBACK_TIMEOUT_MS ) //Max. time for wifi and broker connection, a failed fast resume included
+#define HEATCTRL_TARGET_TIMEOUT_MS 2000 //Max. time for the sync of retained messages after broker connection
+#define HEATCTRL_VALVE_DEADBAND 5 //Min. change of the valve position in 0.1% steps which is worth a motor move
+
+/* Valve settings */
+#define VALVE_STALL_PULSES 4 //Reflex pulses between two stall guard milestones
+#define VALVE_STALL_WINDOW_MS 100 //Motor is stalled if the next milestone is not reached within this time
+#define VALVE_SPINUP_MS 150 //Max. time to the first milestone, spin up and VALVE_STALL_PULSES at VALVE_SPEED_MIN. A motor blocked from the start is stopped after this time
+#define VALVE_MOVE_TIMEOUT_MS 30000 //Safety limit for a single valve movement
+#define VALVE_PWM_FREQUENCY 20000 //PWM frequency of the motor enable pin in Hz, above the audible range
+#define VALVE_CONTROL_PERIOD_MS 10 //Period of the speed control loop
+#define VALVE_SPEED_MIN 40 //Start and end speed in percent, must still reach a stall guard milestone within the window
+#define VALVE_SPEED_MAX 100 //Max. speed in percent
+#define VALVE_ACCELERATION 10 //Speed increase in percent per control period
+#define VALVE_RAMP_COUNTS 40 //Counts before the target where the speed is reduced to VALVE_SPEED_MIN
+#define VALVE_COAST_MS 150 //Time the motor coasts after the target, its overrun is still counted
+#define VALVE_DRIFT_RATE 10 //Initial position error in counts per 1000 counts moved, learned on each endstop contact
+#define VALVE_DRIFT_LIMIT 5 //Full calibration is due when the estimated position error exceeds this percentage of the stroke
+#define VALVE_STROKE_MAX_MOVES 1000 //Full calibration is due when the stroke was not measured for this many moves
+
+/* Valve curve settings */
+#define VALVE_CURVE_LEARN_RATE 10 //Percent of the observed deviation which is learned per valve move
+#define VALVE_CURVE_MIN_STEP 50 //Min. effect change in 0.1% steps of a valve move to learn from
+#define VALVE_CURVE_MIN_INTERVAL 60 //Min. time in seconds between two observations for a measurable temperature trend
+#define VALVE_CURVE_MAX_INTERVAL 3600 //Max. time in seconds between two observations, older trends are not related anymore
+#define VALVE_CURVE_SAVE_UPDATES 8 //Learned updates kept in rtc ram before the table is written to NVS
+
+/* Sleep scheduler default settings */
+#define SLEEP_MIN_PERIOD 20 //Min. deep sleep period in seconds, can be changed by broker
+#define SLEEP_MAX_PERIOD 300 //Max. deep sleep period in seconds, can be changed by broker
+#define SLEEP_TEMP_RESOLUTION 0.1f //Temperature change in °C which is worth a wake up
+#define SLEEP_TARGET_BAND 0.5f //Distance to target temperature in °C which is watched closely
 
 #ifdef __cplusplus
 }
@@ -8,6 +8,45 @@ DRV883X::DRV883X(uint8_t enablePin, uint8_t phasePin, uint8_t sleepPin)
   pinSleep = sleepPin;
 }
 
+#define DRV883X_PWM_RESOLUTION LEDC_TIMER_10_BIT
+#define DRV883X_PWM_MAX_DUTY ((1 << DRV883X_PWM_RESOLUTION) - 1)
+
+void DRV883X::enablePwm(ledc_timer_t timer, ledc_channel_t channel, uint32_t frequency)
+{
+  ledc_timer_config_t timerConfig = {};
+  timerConfig.speed_mode = LEDC_HIGH_SPEED_MODE;
+  timerConfig.duty_resolution = DRV883X_PWM_RESOLUTION;
+  timerConfig.timer_num = timer;
+  timerConfig.freq_hz = frequency;
+  ledc_timer_config( &timerConfig );
+
+  //Start with the bridge disabled
+  ledc_channel_config_t channelConfig = {};
+  channelConfig.gpio_num = pinEnable;
+  channelConfig.speed_mode = LEDC_HIGH_SPEED_MODE;
+  channelConfig.channel = channel;
+  channelConfig.intr_type = LEDC_INTR_DISABLE;
+  channelConfig.timer_sel = timer;
+  channelConfig.duty = 0;
+  ledc_channel_config( &channelConfig );
+
+  pwmChannel = channel;
+  pwm = true;
+}
+
+void DRV883X::speed(uint8_t percent)
+{
+  if( percent > 100 )
+    percent = 100;
+
+  speedPercent = percent;
+
+  if( pwm ) {
+    ledc_set_duty( LEDC_HIGH_SPEED_MODE, pwmChannel, (uint32_t)DRV883X_PWM_MAX_DUTY * percent / 100 );
+    ledc_update_duty( LEDC_HIGH_SPEED_MODE, pwmChannel );
+  }
+}
+
 void DRV883X::sleep(bool sleep)
 {
   gpio_set_level( (gpio_num_t)pinSleep, !sleep );
@@ -15,6 +54,13 @@ void DRV883X::sleep(bool sleep)
 
 void DRV883X::enable(bool en)
 {
+  //Enable pin is driven by the ledc channel
+  if( pwm ) {
+    ledc_set_duty( LEDC_HIGH_SPEED_MODE, pwmChannel, en ? (uint32_t)DRV883X_PWM_MAX_DUTY * speedPercent / 100 : 0 );
+    ledc_update_duty( LEDC_HIGH_SPEED_MODE, pwmChannel );
+    return;
+  }
+
   gpio_set_level( (gpio_num_t)pinEnable, en );
 }
 
@@ -31,9 +77,18 @@ void DRV883X::start( bool dir )
   enable(true);
 }
 
+//Start with the given speed in pwm mode
+void DRV883X::start( bool dir, uint8_t percent )
+{
+  speedPercent = percent > 100 ? 100 : percent;
+  start( dir );
+}
+
 void DRV883X::stop()
 {
-  enable(false);
+  //Ledc calls are not isr safe, sleep disables the bridge at once
+  if( !pwm )
+    enable(false);
   sleep(true);
   direction(0); //Set low for minimum current
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 #define DRV883X_H
 
 #include <stdint.h>
+#include "driver/ledc.h"
 
 class DRV883X {
 
@@ -9,13 +10,22 @@ private:
   uint8_t pinEnable = 0;
   uint8_t pinPhase = 0;
   uint8_t pinSleep = 0;
+  bool pwm = false;
+  ledc_channel_t pwmChannel = LEDC_CHANNEL_0;
+  uint8_t speedPercent = 100;
 
 public:
   DRV883X(uint8_t enablePin, uint8_t phasePin, uint8_t sleepPin);
+  //Drive the enable pin by a LEDC channel, so the speed can be set
+  void enablePwm(ledc_timer_t timer, ledc_channel_t channel, uint32_t frequency);
+  //Speed in percent of full duty, only in pwm mode. Not for isr context
+  void speed(uint8_t percent);
   void sleep(bool sleep);
   void enable(bool en);
   void direction(uint8_t dir);
   void start( bool dir );
+  void start( bool dir, uint8_t percent );
+  //Safe for isr context, in pwm mode the bridge is put to sleep while the duty is kept
   void stop();
 
 
@@ -1,4 +1,5 @@
 #include <lwip/netdb.h>
+#include <fcntl.h>
 #include <string.h>  // needed
 
 // Some docs about lwip:
@@ -23,9 +24,17 @@ int32_t esp_lwmqtt_timer_get(void *ref) {
 }
 
 lwmqtt_err_t esp_lwmqtt_network_connect(esp_lwmqtt_network_t *network, char *host, char *port) {
-  // disconnect if not already the case
-  esp_lwmqtt_network_disconnect(network);
+  // lookup ip address
+  struct sockaddr_in addr;
+  lwmqtt_err_t err = esp_lwmqtt_network_resolve(host, port, &addr);
+  if (err != LWMQTT_SUCCESS) {
+    return err;
+  }
 
+  return esp_lwmqtt_network_connect_addr(network, &addr);
+}
+
+lwmqtt_err_t esp_lwmqtt_network_resolve(char *host, char *port, struct sockaddr_in *addr) {
   // prepare hints
   struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_STREAM};
 
@@ -36,24 +45,32 @@ lwmqtt_err_t esp_lwmqtt_network_connect(esp_lwmqtt_network_t *network, char *hos
     return LWMQTT_NETWORK_FAILED_CONNECT;
   }
 
+  // copy address
+  memcpy(addr, res->ai_addr, sizeof(struct sockaddr_in));
+
+  // free address
+  lwip_freeaddrinfo(res);
+
+  return LWMQTT_SUCCESS;
+}
+
+lwmqtt_err_t esp_lwmqtt_network_connect_addr(esp_lwmqtt_network_t *network, struct sockaddr_in *addr) {
+  // disconnect if not already the case
+  esp_lwmqtt_network_disconnect(network);
+
   // create socket
-  network->socket = lwip_socket(res->ai_family, res->ai_socktype, 0);
+  network->socket = lwip_socket(AF_INET, SOCK_STREAM, 0);
   if (network->socket < 0) {
-    lwip_freeaddrinfo(res);
     return LWMQTT_NETWORK_FAILED_CONNECT;
   }
 
   // connect socket
-  r = lwip_connect_r(network->socket, res->ai_addr, res->ai_addrlen);
+  int r = lwip_connect_r(network->socket, (struct sockaddr *)addr, sizeof(struct sockaddr_in));
   if (r < 0) {
     lwip_close_r(network->socket);
-    lwip_freeaddrinfo(res);
     return LWMQTT_NETWORK_FAILED_CONNECT;
   }
 
-  // free address
-  lwip_freeaddrinfo(res);
-
   // disable nagle's algorithm
   int flag = 1;
   r = lwip_setsockopt_r(network->socket, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(int));
@@ -62,9 +79,32 @@ lwmqtt_err_t esp_lwmqtt_network_connect(esp_lwmqtt_network_t *network, char *hos
     return LWMQTT_NETWORK_FAILED_CONNECT;
   }
 
+  // make socket non-blocking, timeouts are handled by select
+  r = lwip_fcntl_r(network->socket, F_SETFL, O_NONBLOCK);
+  if (r < 0) {
+    lwip_close_r(network->socket);
+    return LWMQTT_NETWORK_FAILED_CONNECT;
+  }
+
+  // reset receive buffer
+  network->rx_pos = 0;
+  network->rx_len = 0;
+
   return LWMQTT_SUCCESS;
 }
 
+static int esp_lwmqtt_network_wait(esp_lwmqtt_network_t *network, bool write, uint32_t timeout) {
+  // prepare set
+  fd_set set;
+  FD_ZERO(&set);
+  FD_SET(network->socket, &set);
+
+  // wait until socket is ready
+  network->syscalls.select++;
+  struct timeval t = {.tv_sec = timeout / 1000, .tv_usec = (timeout % 1000) * 1000};
+  return lwip_select(network->socket + 1, write ? NULL : &set, write ? &set : NULL, NULL, &t);
+}
+
 void esp_lwmqtt_network_disconnect(esp_lwmqtt_network_t *network) {
   // close socket if present
   if (network->socket) {
@@ -74,14 +114,14 @@ void esp_lwmqtt_network_disconnect(esp_lwmqtt_network_t *network) {
 }
 
 lwmqtt_err_t esp_lwmqtt_network_select(esp_lwmqtt_network_t *network, bool *available, uint32_t timeout) {
-  // prepare set
-  fd_set set;
-  FD_ZERO(&set);
-  FD_SET(network->socket, &set);
+  // data is already buffered
+  if (network->rx_len > 0) {
+    *available = true;
+    return LWMQTT_SUCCESS;
+  }
 
   // wait for data
-  struct timeval t = {.tv_sec = timeout / 1000, .tv_usec = (timeout % 1000) * 1000};
-  int result = lwip_select(network->socket + 1, &set, NULL, NULL, &t);
+  int result = esp_lwmqtt_network_wait(network, false, timeout);
   if (result < 0) {
     return LWMQTT_NETWORK_FAILED_READ;
   }
@@ -94,11 +134,15 @@ lwmqtt_err_t esp_lwmqtt_network_select(esp_lwmqtt_network_t *network, bool *avai
 
 lwmqtt_err_t esp_lwmqtt_network_peek(esp_lwmqtt_network_t *network, size_t *available) {
   // get the available bytes on the socket
+  network->syscalls.ioctl++;
   int rc = lwip_ioctl_r(network->socket, FIONREAD, available);
   if (rc < 0) {
     return LWMQTT_NETWORK_FAILED_READ;
   }
 
+  // add buffered bytes
+  *available += network->rx_len;
+
   return LWMQTT_SUCCESS;
 }
 
@@ -106,39 +150,85 @@ lwmqtt_err_t esp_lwmqtt_network_read(void *ref, uint8_t *buffer, size_t len, siz
   // cast network reference
   esp_lwmqtt_network_t *n = (esp_lwmqtt_network_t *)ref;
 
-  // set timeout
-  struct timeval t = {.tv_sec = timeout / 1000, .tv_usec = (timeout % 1000) * 1000};
-  int rc = lwip_setsockopt_r(n->socket, SOL_SOCKET, SO_RCVTIMEO, (char *)&t, sizeof(t));
-  if (rc < 0) {
-    return LWMQTT_NETWORK_FAILED_READ;
+  // copy from receive buffer if not empty
+  if (n->rx_len > 0) {
+    size_t copy = len < n->rx_len ? len : n->rx_len;
+    memcpy(buffer, n->rx_buf + n->rx_pos, copy);
+    n->rx_pos += copy;
+    n->rx_len -= copy;
+
+    // increment counter
+    *read += copy;
+
+    return LWMQTT_SUCCESS;
   }
 
+  // read directly into large buffers, otherwise fill the receive buffer
+  bool direct = len >= sizeof(n->rx_buf);
+  uint8_t *dst = direct ? buffer : n->rx_buf;
+  size_t dst_len = direct ? len : sizeof(n->rx_buf);
+
   // read from socket
-  int bytes = lwip_read_r(n->socket, buffer, len);
-  if (bytes < 0 && errno != EAGAIN) {
+  n->syscalls.read++;
+  int bytes = lwip_read_r(n->socket, dst, dst_len);
+
+  // wait for data once if none is available
+  if (bytes < 0 && errno == EAGAIN) {
+    int result = esp_lwmqtt_network_wait(n, false, timeout);
+    if (result < 0) {
+      return LWMQTT_NETWORK_FAILED_READ;
+    } else if (result == 0) {
+      // the caller checks its timer
+      return LWMQTT_SUCCESS;
+    }
+
+    // read again
+    n->syscalls.read++;
+    bytes = lwip_read_r(n->socket, dst, dst_len);
+  }
+
+  // a closed connection reads zero bytes
+  if (bytes <= 0) {
     return LWMQTT_NETWORK_FAILED_READ;
   }
 
-  // increment counter
-  *read += bytes;
+  // done if read directly
+  if (direct) {
+    *read += bytes;
+    return LWMQTT_SUCCESS;
+  }
 
-  return LWMQTT_SUCCESS;
+  // set receive buffer and copy requested bytes
+  n->rx_pos = 0;
+  n->rx_len = (size_t)bytes;
+
+  return esp_lwmqtt_network_read(ref, buffer, len, read, timeout);
 }
 
 lwmqtt_err_t esp_lwmqtt_network_write(void *ref, uint8_t *buffer, size_t len, size_t *sent, uint32_t timeout) {
   // cast network reference
   esp_lwmqtt_network_t *n = (esp_lwmqtt_network_t *)ref;
 
-  // set timeout
-  struct timeval t = {.tv_sec = timeout / 1000, .tv_usec = (timeout % 1000) * 1000};
-  int rc = lwip_setsockopt_r(n->socket, SOL_SOCKET, SO_SNDTIMEO, (char *)&t, sizeof(t));
-  if (rc < 0) {
-    return LWMQTT_NETWORK_FAILED_WRITE;
-  }
-
   // write to socket
+  n->syscalls.write++;
   int bytes = lwip_write_r(n->socket, buffer, len);
-  if (bytes < 0 && errno != EAGAIN) {
+
+  // wait for space once if the send buffer is full
+  if (bytes < 0 && errno == EAGAIN) {
+    int result = esp_lwmqtt_network_wait(n, true, timeout);
+    if (result < 0) {
+      return LWMQTT_NETWORK_FAILED_WRITE;
+    } else if (result == 0) {
+      // the caller checks its timer
+      return LWMQTT_SUCCESS;
+    }
+
+    // write again
+    n->syscalls.write++;
+    bytes = lwip_write_r(n->socket, buffer, len);
+  }
+
+  if (bytes < 0) {
     return LWMQTT_NETWORK_FAILED_WRITE;
   }
 
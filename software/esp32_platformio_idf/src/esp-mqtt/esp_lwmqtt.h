@@ -1,6 +1,8 @@
 #ifndef ESP_LWMQTT_H
 #define ESP_LWMQTT_H
 
+#include <lwip/sockets.h>
+
 #include "lwmqtt/include/lwmqtt.h"
 
 /**
@@ -20,11 +22,28 @@ void esp_lwmqtt_timer_set(void *ref, uint32_t timeout);
  */
 int32_t esp_lwmqtt_timer_get(void *ref);
 
+/**
+ * The socket call counters of a network object.
+ */
+typedef struct {
+  uint32_t read;
+  uint32_t write;
+  uint32_t select;
+  uint32_t ioctl;
+} esp_lwmqtt_syscalls_t;
+
 /**
  * The lwmqtt network object for the esp platform.
+ *
+ * The socket is non-blocking. Incoming data is read in chunks of up to CONFIG_ESP_MQTT_RX_BUFFER_SIZE bytes into the
+ * receive buffer, so a whole packet usually takes a single socket read.
  */
 typedef struct {
   int socket;
+  uint8_t rx_buf[CONFIG_ESP_MQTT_RX_BUFFER_SIZE];
+  size_t rx_pos;
+  size_t rx_len;
+  esp_lwmqtt_syscalls_t syscalls;
 } esp_lwmqtt_network_t;
 
 /**
@@ -32,18 +51,29 @@ typedef struct {
  */
 lwmqtt_err_t esp_lwmqtt_network_connect(esp_lwmqtt_network_t *network, char *host, char *port);
 
+/**
+ * Resolve the address of the specified remote host.
+ */
+lwmqtt_err_t esp_lwmqtt_network_resolve(char *host, char *port, struct sockaddr_in *addr);
+
+/**
+ * Initiate a connection to the specified already resolved address.
+ */
+lwmqtt_err_t esp_lwmqtt_network_connect_addr(esp_lwmqtt_network_t *network, struct sockaddr_in *addr);
+
 /**
  * Terminate the connection.
  */
 void esp_lwmqtt_network_disconnect(esp_lwmqtt_network_t *network);
 
 /**
- * Will set available to the available amount of data in the underlying network buffer.
+ * Will set available to the available amount of data in the receive and the underlying network buffer.
  */
 lwmqtt_err_t esp_lwmqtt_network_peek(esp_lwmqtt_network_t *network, size_t *available);
 
 /**
- * Will wait for a socket until data is available or the timeout has been reached.
+ * Will wait for a socket until data is available or the timeout has been reached. Returns immediately if the receive
+ * buffer is not empty.
  */
 lwmqtt_err_t esp_lwmqtt_network_select(esp_lwmqtt_network_t *network, bool *available, uint32_t timeout);
 
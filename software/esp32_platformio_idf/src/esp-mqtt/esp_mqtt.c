@@ -1,3 +1,5 @@
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
@@ -47,12 +49,24 @@ static struct {
   bool retained;
 } esp_mqtt_lwt_config = {.topic = NULL, .payload = NULL, .qos = 0, .retained = false};
 
+static struct {
+  bool persistent;
+  bool present;
+} esp_mqtt_session_config = {.persistent = false, .present = false};
+
+// the resolved broker address is kept in rtc ram to skip the dns lookup after deep sleep
+static RTC_DATA_ATTR struct {
+  bool valid;
+  struct sockaddr_in addr;
+} esp_mqtt_broker_cache;
+
 static bool esp_mqtt_running = false;
 static bool esp_mqtt_connected = false;
 static bool esp_mqtt_error = false;
 
 static esp_mqtt_status_callback_t esp_mqtt_status_callback = NULL;
 static esp_mqtt_message_callback_t esp_mqtt_message_callback = NULL;
+static esp_mqtt_inplace_callback_t esp_mqtt_inplace_callback = NULL;
 
 static lwmqtt_client_t esp_mqtt_client;
 
@@ -60,17 +74,61 @@ static esp_lwmqtt_network_t esp_mqtt_network = {0};
 
 static esp_lwmqtt_timer_t esp_mqtt_timer1, esp_mqtt_timer2;
 
+static lwmqtt_inflight_t esp_mqtt_inflight_table[CONFIG_ESP_MQTT_INFLIGHT_WINDOW];
+
+// counts acked async messages over all connections
+static volatile uint32_t esp_mqtt_completed_count = 0;
+
 static void *esp_mqtt_write_buffer;
 static void *esp_mqtt_read_buffer;
 
 static QueueHandle_t esp_mqtt_event_queue = NULL;
 
+// the event slots are allocated once on init, free slots are kept in a queue
+static uint8_t *esp_mqtt_event_slots = NULL;
+static QueueHandle_t esp_mqtt_event_pool = NULL;
+
+static esp_mqtt_stats_t esp_mqtt_stats_data = {0};
+
 typedef struct {
   lwmqtt_string_t topic;
   lwmqtt_message_t message;
 } esp_mqtt_event_t;
 
-void esp_mqtt_init(esp_mqtt_status_callback_t scb, esp_mqtt_message_callback_t mcb, size_t buffer_size,
+// one slot holds the event followed by topic and payload including their null terminations
+#define ESP_MQTT_EVENT_SLOT_SIZE(buffer_size) ((sizeof(esp_mqtt_event_t) + (buffer_size) + 2 + 3) & ~(size_t)3)
+
+// free everything allocated by esp_mqtt_init
+static void esp_mqtt_free() {
+  free(esp_mqtt_write_buffer);
+  free(esp_mqtt_read_buffer);
+  free(esp_mqtt_event_slots);
+  esp_mqtt_write_buffer = NULL;
+  esp_mqtt_read_buffer = NULL;
+  esp_mqtt_event_slots = NULL;
+
+  if (esp_mqtt_main_mutex != NULL) {
+    vSemaphoreDelete(esp_mqtt_main_mutex);
+    esp_mqtt_main_mutex = NULL;
+  }
+
+  if (esp_mqtt_select_mutex != NULL) {
+    vSemaphoreDelete(esp_mqtt_select_mutex);
+    esp_mqtt_select_mutex = NULL;
+  }
+
+  if (esp_mqtt_event_queue != NULL) {
+    vQueueDelete(esp_mqtt_event_queue);
+    esp_mqtt_event_queue = NULL;
+  }
+
+  if (esp_mqtt_event_pool != NULL) {
+    vQueueDelete(esp_mqtt_event_pool);
+    esp_mqtt_event_pool = NULL;
+  }
+}
+
+bool esp_mqtt_init(esp_mqtt_status_callback_t scb, esp_mqtt_message_callback_t mcb, size_t buffer_size,
                    int command_timeout) {
   // set callbacks
   esp_mqtt_status_callback = scb;
@@ -88,15 +146,54 @@ void esp_mqtt_init(esp_mqtt_status_callback_t scb, esp_mqtt_message_callback_t m
 
   // create queue
   esp_mqtt_event_queue = xQueueCreate(CONFIG_ESP_MQTT_EVENT_QUEUE_SIZE, sizeof(esp_mqtt_event_t *));
+
+  // allocate event slots, an incoming packet never exceeds the read buffer
+  esp_mqtt_event_slots = malloc(CONFIG_ESP_MQTT_EVENT_QUEUE_SIZE * ESP_MQTT_EVENT_SLOT_SIZE(buffer_size));
+
+  // create pool for the slots
+  esp_mqtt_event_pool = xQueueCreate(CONFIG_ESP_MQTT_EVENT_QUEUE_SIZE, sizeof(esp_mqtt_event_t *));
+
+  // check allocations
+  if (esp_mqtt_write_buffer == NULL || esp_mqtt_read_buffer == NULL || esp_mqtt_event_slots == NULL ||
+      esp_mqtt_main_mutex == NULL || esp_mqtt_select_mutex == NULL || esp_mqtt_event_queue == NULL ||
+      esp_mqtt_event_pool == NULL) {
+    ESP_LOGE(ESP_MQTT_LOG_TAG, "esp_mqtt_init: out of memory");
+    esp_mqtt_free();
+    return false;
+  }
+
+  // fill pool with all slots
+  for (int i = 0; i < CONFIG_ESP_MQTT_EVENT_QUEUE_SIZE; i++) {
+    esp_mqtt_event_t *evt = (esp_mqtt_event_t *)(esp_mqtt_event_slots + i * ESP_MQTT_EVENT_SLOT_SIZE(buffer_size));
+    xQueueSend(esp_mqtt_event_pool, &evt, 0);
+  }
+
+  return true;
 }
 
 static void esp_mqtt_message_handler(lwmqtt_client_t *client, void *ref, lwmqtt_string_t topic, lwmqtt_message_t msg) {
-  // create message
-  esp_mqtt_event_t *evt = malloc(sizeof(esp_mqtt_event_t));
+  // deliver in place if handled by callback
+  if (esp_mqtt_inplace_callback && esp_mqtt_inplace_callback(topic, msg)) {
+    return;
+  }
+
+  // take a free slot, drop the message if all slots are in use
+  esp_mqtt_event_t *evt = NULL;
+  if (xQueueReceive(esp_mqtt_event_pool, &evt, 0) != pdTRUE) {
+    esp_mqtt_stats_data.events_dropped++;
+    ESP_LOGE(ESP_MQTT_LOG_TAG, "esp_mqtt_message_handler: no free slot, dropping message");
+    return;
+  }
+
+  // update high water mark
+  uint32_t used = CONFIG_ESP_MQTT_EVENT_QUEUE_SIZE - (uint32_t)uxQueueMessagesWaiting(esp_mqtt_event_pool);
+  if (used > esp_mqtt_stats_data.events_used_max) {
+    esp_mqtt_stats_data.events_used_max = used;
+  }
 
   // copy topic with additional null termination
   evt->topic.len = topic.len;
-  evt->topic.data = malloc((size_t)topic.len + 1);
+  evt->topic.data = (char *)(evt + 1);
   memcpy(evt->topic.data, topic.data, (size_t)topic.len);
   evt->topic.data[topic.len] = 0;
 
@@ -104,17 +201,17 @@ static void esp_mqtt_message_handler(lwmqtt_client_t *client, void *ref, lwmqtt_
   evt->message.retained = msg.retained;
   evt->message.qos = msg.qos;
   evt->message.payload_len = msg.payload_len;
-  evt->message.payload = malloc((size_t)msg.payload_len + 1);
+  evt->message.payload = (uint8_t *)evt->topic.data + topic.len + 1;
   memcpy(evt->message.payload, msg.payload, (size_t)msg.payload_len);
   evt->message.payload[msg.payload_len] = 0;
 
-  // queue event
-  if (xQueueSend(esp_mqtt_event_queue, &evt, 0) != pdTRUE) {
-    ESP_LOGE(ESP_MQTT_LOG_TAG, "xQueueSend: queue is full, dropping message");
-    free(evt->topic.data);
-    free(evt->message.payload);
-    free(evt);
-  }
+  // queue event, the event queue has the same size as the pool and can't be full
+  xQueueSend(esp_mqtt_event_queue, &evt, 0);
+}
+
+static void esp_mqtt_inflight_handler(lwmqtt_client_t *client, void *ref, uint16_t packet_id) {
+  // count acked message
+  esp_mqtt_completed_count++;
 }
 
 static void esp_mqtt_dispatch_events() {
@@ -128,13 +225,26 @@ static void esp_mqtt_dispatch_events() {
       esp_mqtt_message_callback(evt->topic.data, evt->message.payload, evt->message.payload_len);
     }
 
-    // free data
-    free(evt->topic.data);
-    free(evt->message.payload);
-    free(evt);
+    // return slot to pool
+    xQueueSend(esp_mqtt_event_pool, &evt, 0);
   }
 }
 
+void esp_mqtt_stats(esp_mqtt_stats_t *stats) {
+  // copy event counters
+  *stats = esp_mqtt_stats_data;
+
+  // add heap state
+  stats->heap_free = (uint32_t)heap_caps_get_free_size(MALLOC_CAP_8BIT);
+  stats->heap_free_min = (uint32_t)heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+
+  // add socket calls
+  stats->socket_reads = esp_mqtt_network.syscalls.read;
+  stats->socket_writes = esp_mqtt_network.syscalls.write;
+  stats->socket_selects = esp_mqtt_network.syscalls.select;
+  stats->socket_ioctls = esp_mqtt_network.syscalls.ioctl;
+}
+
 static bool esp_mqtt_process_connect() {
   // initialize the client
   lwmqtt_init(&esp_mqtt_client, esp_mqtt_write_buffer, esp_mqtt_buffer_size, esp_mqtt_read_buffer,
@@ -142,17 +252,36 @@ static bool esp_mqtt_process_connect() {
   lwmqtt_set_network(&esp_mqtt_client, &esp_mqtt_network, esp_lwmqtt_network_read, esp_lwmqtt_network_write);
   lwmqtt_set_timers(&esp_mqtt_client, &esp_mqtt_timer1, &esp_mqtt_timer2, esp_lwmqtt_timer_set, esp_lwmqtt_timer_get);
   lwmqtt_set_callback(&esp_mqtt_client, NULL, esp_mqtt_message_handler);
+  lwmqtt_set_inflight(&esp_mqtt_client, esp_mqtt_inflight_table, CONFIG_ESP_MQTT_INFLIGHT_WINDOW, NULL,
+                      esp_mqtt_inflight_handler);
+  lwmqtt_set_buffered(&esp_mqtt_client, true);
+
+  // resolve broker address if not cached
+  lwmqtt_err_t err;
+  if (!esp_mqtt_session_config.persistent || !esp_mqtt_broker_cache.valid) {
+    err = esp_lwmqtt_network_resolve(esp_mqtt_config.host, esp_mqtt_config.port, &esp_mqtt_broker_cache.addr);
+    if (err != LWMQTT_SUCCESS) {
+      ESP_LOGE(ESP_MQTT_LOG_TAG, "esp_lwmqtt_network_resolve: %d", err);
+      return false;
+    }
+
+    // set cache flag
+    esp_mqtt_broker_cache.valid = true;
+  }
 
   // attempt network connection
-  lwmqtt_err_t err = esp_lwmqtt_network_connect(&esp_mqtt_network, esp_mqtt_config.host, esp_mqtt_config.port);
+  err = esp_lwmqtt_network_connect_addr(&esp_mqtt_network, &esp_mqtt_broker_cache.addr);
   if (err != LWMQTT_SUCCESS) {
-    ESP_LOGE(ESP_MQTT_LOG_TAG, "esp_lwmqtt_network_connect: %d", err);
+    // resolve address again on next attempt
+    esp_mqtt_broker_cache.valid = false;
+    ESP_LOGE(ESP_MQTT_LOG_TAG, "esp_lwmqtt_network_connect_addr: %d", err);
     return false;
   }
 
   // setup connect data
   lwmqtt_options_t options = lwmqtt_default_options;
   options.keep_alive = 10;
+  options.clean_session = !esp_mqtt_session_config.persistent;
   options.client_id = lwmqtt_string(esp_mqtt_config.client_id);
   options.username = lwmqtt_string(esp_mqtt_config.username);
   options.password = lwmqtt_string(esp_mqtt_config.password);
@@ -166,13 +295,16 @@ static bool esp_mqtt_process_connect() {
 
   // attempt connection
   lwmqtt_return_code_t return_code;
-  err =
-      lwmqtt_connect(&esp_mqtt_client, options, will.topic.len ? &will : NULL, &return_code, esp_mqtt_command_timeout);
+  err = lwmqtt_connect(&esp_mqtt_client, options, will.topic.len ? &will : NULL, &return_code,
+                       esp_mqtt_command_timeout);
   if (err != LWMQTT_SUCCESS) {
     ESP_LOGE(ESP_MQTT_LOG_TAG, "lwmqtt_connect: %d", err);
     return false;
   }
 
+  // remember whether the broker resumed the session
+  esp_mqtt_session_config.present = lwmqtt_session_present(&esp_mqtt_client);
+
   return true;
 }
 
@@ -225,9 +357,12 @@ static void esp_mqtt_process(void *p) {
     // acquire select mutex
     ESP_MQTT_LOCK_SELECT();
 
-    // block until data is available
+    // block until data is available, unless the client has still buffered a complete packet
     bool available = false;
-    lwmqtt_err_t err = esp_lwmqtt_network_select(&esp_mqtt_network, &available, esp_mqtt_command_timeout);
+    lwmqtt_err_t err = LWMQTT_SUCCESS;
+    if (!lwmqtt_buffered_packet(&esp_mqtt_client)) {
+      err = esp_lwmqtt_network_select(&esp_mqtt_network, &available, esp_mqtt_command_timeout);
+    }
     if (err != LWMQTT_SUCCESS) {
       ESP_LOGE(ESP_MQTT_LOG_TAG, "esp_lwmqtt_network_select: %d", err);
       ESP_MQTT_UNLOCK_SELECT();
@@ -240,8 +375,11 @@ static void esp_mqtt_process(void *p) {
     // acquire mutex
     ESP_MQTT_LOCK_MAIN();
 
-    // process data if available
-    if (available) {
+    // buffered data might have been left by a command in the meantime
+    size_t buffered_bytes = lwmqtt_buffered(&esp_mqtt_client);
+
+    // process data if available, a partial packet waits for the next select
+    if (available || lwmqtt_buffered_packet(&esp_mqtt_client)) {
       // get available bytes
       size_t available_bytes = 0;
       err = esp_lwmqtt_network_peek(&esp_mqtt_network, &available_bytes);
@@ -251,6 +389,9 @@ static void esp_mqtt_process(void *p) {
         break;
       }
 
+      // add bytes already read by the client
+      available_bytes += buffered_bytes;
+
       // yield client only if there is still data to read since select might unblock because of incoming ack packets
       // that are already handled until we get to this point
       if (available_bytes > 0) {
@@ -339,6 +480,30 @@ void esp_mqtt_lwt(const char *topic, const char *payload, int qos, bool retained
   ESP_MQTT_UNLOCK_MAIN();
 }
 
+void esp_mqtt_session(bool persistent) {
+  // acquire mutex
+  ESP_MQTT_LOCK_MAIN();
+
+  // set persistent flag
+  esp_mqtt_session_config.persistent = persistent;
+
+  // release mutex
+  ESP_MQTT_UNLOCK_MAIN();
+}
+
+void esp_mqtt_inplace(esp_mqtt_inplace_callback_t cb) {
+  // acquire mutex
+  ESP_MQTT_LOCK_MAIN();
+
+  // set callback
+  esp_mqtt_inplace_callback = cb;
+
+  // release mutex
+  ESP_MQTT_UNLOCK_MAIN();
+}
+
+bool esp_mqtt_session_present() { return esp_mqtt_session_config.persistent && esp_mqtt_session_config.present; }
+
 void esp_mqtt_start(const char *host, const char *port, const char *client_id, const char *username,
                     const char *password) {
   // acquire mutex
@@ -478,12 +643,16 @@ bool esp_mqtt_unsubscribe(const char *topic) {
 }
 
 bool esp_mqtt_publish(const char *topic, uint8_t *payload, size_t len, int qos, bool retained) {
+  return esp_mqtt_publish_topic(lwmqtt_string(topic), payload, len, qos, retained);
+}
+
+bool esp_mqtt_publish_topic(lwmqtt_string_t topic, uint8_t *payload, size_t len, int qos, bool retained) {
   // acquire mutex
   ESP_MQTT_LOCK_MAIN();
 
   // check if still connected
   if (!esp_mqtt_connected) {
-    ESP_LOGW(ESP_MQTT_LOG_TAG, "esp_mqtt_publish: not connected");
+    ESP_LOGW(ESP_MQTT_LOG_TAG, "esp_mqtt_publish_topic: not connected");
     ESP_MQTT_UNLOCK_MAIN();
     return false;
   }
@@ -496,7 +665,7 @@ bool esp_mqtt_publish(const char *topic, uint8_t *payload, size_t len, int qos,
   message.payload_len = len;
 
   // publish message
-  lwmqtt_err_t err = lwmqtt_publish(&esp_mqtt_client, lwmqtt_string(topic), message, esp_mqtt_command_timeout);
+  lwmqtt_err_t err = lwmqtt_publish(&esp_mqtt_client, topic, message, esp_mqtt_command_timeout);
   if (err != LWMQTT_SUCCESS) {
     esp_mqtt_error = true;
     ESP_LOGE(ESP_MQTT_LOG_TAG, "lwmqtt_publish: %d", err);
@@ -513,6 +682,116 @@ bool esp_mqtt_publish(const char *topic, uint8_t *payload, size_t len, int qos,
   return true;
 }
 
+bool esp_mqtt_publish_prepared(lwmqtt_publish_template_t *tpl, uint8_t *payload, size_t len) {
+  // acquire mutex
+  ESP_MQTT_LOCK_MAIN();
+
+  // check if still connected
+  if (!esp_mqtt_connected) {
+    ESP_LOGW(ESP_MQTT_LOG_TAG, "esp_mqtt_publish_prepared: not connected");
+    ESP_MQTT_UNLOCK_MAIN();
+    return false;
+  }
+
+  // publish message
+  lwmqtt_err_t err = lwmqtt_publish_prepared(&esp_mqtt_client, tpl, payload, len, esp_mqtt_command_timeout);
+  if (err != LWMQTT_SUCCESS) {
+    esp_mqtt_error = true;
+    ESP_LOGE(ESP_MQTT_LOG_TAG, "lwmqtt_publish_prepared: %d", err);
+    ESP_MQTT_UNLOCK_MAIN();
+    return false;
+  }
+
+  // release mutex
+  ESP_MQTT_UNLOCK_MAIN();
+
+  // dispatch queued events
+  esp_mqtt_dispatch_events();
+
+  return true;
+}
+
+bool esp_mqtt_publish_async(lwmqtt_string_t topic, uint8_t *payload, size_t len, int qos, bool retained) {
+  // acquire mutex
+  ESP_MQTT_LOCK_MAIN();
+
+  // check if still connected
+  if (!esp_mqtt_connected) {
+    ESP_LOGW(ESP_MQTT_LOG_TAG, "esp_mqtt_publish_async: not connected");
+    ESP_MQTT_UNLOCK_MAIN();
+    return false;
+  }
+
+  // prepare message
+  lwmqtt_message_t message;
+  message.qos = (lwmqtt_qos_t)qos;
+  message.retained = retained;
+  message.payload = payload;
+  message.payload_len = len;
+
+  // publish message without waiting for acks
+  lwmqtt_err_t err = lwmqtt_publish_async(&esp_mqtt_client, topic, message, NULL, esp_mqtt_command_timeout);
+  if (err == LWMQTT_INFLIGHT_WINDOW_FULL) {
+    // the connection is still fine
+    ESP_MQTT_UNLOCK_MAIN();
+    return false;
+  } else if (err != LWMQTT_SUCCESS) {
+    esp_mqtt_error = true;
+    ESP_LOGE(ESP_MQTT_LOG_TAG, "lwmqtt_publish_async: %d", err);
+    ESP_MQTT_UNLOCK_MAIN();
+    return false;
+  }
+
+  // release mutex
+  ESP_MQTT_UNLOCK_MAIN();
+
+  return true;
+}
+
+int esp_mqtt_inflight() {
+  // acquire mutex
+  ESP_MQTT_LOCK_MAIN();
+
+  // count messages in flight
+  int count = lwmqtt_inflight_count(&esp_mqtt_client);
+
+  // release mutex
+  ESP_MQTT_UNLOCK_MAIN();
+
+  return count;
+}
+
+uint32_t esp_mqtt_completed() { return esp_mqtt_completed_count; }
+
+bool esp_mqtt_publish_batch(int count, lwmqtt_string_t *topics, lwmqtt_message_t *messages) {
+  // acquire mutex
+  ESP_MQTT_LOCK_MAIN();
+
+  // check if still connected
+  if (!esp_mqtt_connected) {
+    ESP_LOGW(ESP_MQTT_LOG_TAG, "esp_mqtt_publish_batch: not connected");
+    ESP_MQTT_UNLOCK_MAIN();
+    return false;
+  }
+
+  // publish messages
+  lwmqtt_err_t err = lwmqtt_publish_batch(&esp_mqtt_client, count, topics, messages, esp_mqtt_command_timeout);
+  if (err != LWMQTT_SUCCESS) {
+    esp_mqtt_error = true;
+    ESP_LOGE(ESP_MQTT_LOG_TAG, "lwmqtt_publish_batch: %d", err);
+    ESP_MQTT_UNLOCK_MAIN();
+    return false;
+  }
+
+  // release mutex
+  ESP_MQTT_UNLOCK_MAIN();
+
+  // dispatch queued events
+  esp_mqtt_dispatch_events();
+
+  return true;
+}
+
 void esp_mqtt_stop() {
   // acquire mutexes
   ESP_MQTT_LOCK_MAIN();
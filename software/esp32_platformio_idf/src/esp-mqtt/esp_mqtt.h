@@ -4,6 +4,8 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "lwmqtt/include/lwmqtt.h"
+
 /**
  * The statuses emitted by the status callback.
  */
@@ -19,17 +21,42 @@ typedef void (*esp_mqtt_status_callback_t)(esp_mqtt_status_t);
  */
 typedef void (*esp_mqtt_message_callback_t)(const char *topic, uint8_t *payload, size_t len);
 
+/**
+ * The in-place message callback.
+ *
+ * Topic and payload are views into the read buffer and are not null terminated. Return false to pass the message on to
+ * the queued message callback.
+ */
+typedef bool (*esp_mqtt_inplace_callback_t)(lwmqtt_string_t topic, lwmqtt_message_t msg);
+
+/**
+ * The statistics of the inbound message path and the socket calls.
+ */
+typedef struct {
+  uint32_t events_used_max;
+  uint32_t events_dropped;
+  uint32_t heap_free;
+  uint32_t heap_free_min;
+  uint32_t socket_reads;
+  uint32_t socket_writes;
+  uint32_t socket_selects;
+  uint32_t socket_ioctls;
+} esp_mqtt_stats_t;
+
 /**
  * Initialize the MQTT management system.
  *
- * Note: Should only be called once on boot.
+ * Note: Should only be called once on boot. All memory for incoming messages is allocated here: a pool of
+ * CONFIG_ESP_MQTT_EVENT_QUEUE_SIZE slots, each large enough for a packet of the configured buffer size. Incoming
+ * messages are dropped while all slots are in use.
  *
  * @param scb - The status callback.
  * @param mcb - The message callback.
  * @param buffer_size - The read and write buffer size.
  * @param command_timeout - The command timeout.
+ * @return Whether all memory could be allocated. Nothing is allocated on failure and the client must not be started.
  */
-void esp_mqtt_init(esp_mqtt_status_callback_t scb, esp_mqtt_message_callback_t mcb, size_t buffer_size,
+bool esp_mqtt_init(esp_mqtt_status_callback_t scb, esp_mqtt_message_callback_t mcb, size_t buffer_size,
                    int command_timeout);
 
 /**
@@ -44,6 +71,45 @@ void esp_mqtt_init(esp_mqtt_status_callback_t scb, esp_mqtt_message_callback_t m
  */
 void esp_mqtt_lwt(const char *topic, const char *payload, int qos, bool retained);
 
+/**
+ * Configure a persistent session.
+ *
+ * A persistent session connects with clean_session=false, so the broker keeps the subscriptions of the client between
+ * connections. The resolved broker address is kept in RTC memory and reused after deep sleep instead of a new DNS
+ * lookup. The cached address is dropped as soon as a connection attempt with it fails.
+ *
+ * Note: Must be called before esp_mqtt_start.
+ *
+ * @param persistent - The persistent session flag.
+ */
+void esp_mqtt_session(bool persistent);
+
+/**
+ * Check if the broker reported an existing session in the last CONNACK.
+ *
+ * Note: Only valid after the status callback has been called with `ESP_MQTT_STATUS_CONNECTED`.
+ *
+ * @return Whether a persistent session is configured and was present on the broker.
+ */
+bool esp_mqtt_session_present();
+
+/**
+ * Configure in-place message delivery.
+ *
+ * The callback is invoked synchronously from the background process while the packet is read. It receives views into
+ * the read buffer, so there is no copy, no queue hop and no dispatch delay. Messages for which the callback returns
+ * false are copied and queued for the regular message callback as usual. Without an in-place callback all messages are
+ * queued, which is the default.
+ *
+ * Note: The callback runs while the client is locked. It must not block and must not call any other esp_mqtt function,
+ * especially not `esp_mqtt_publish`. The views are only valid until the callback returns.
+ *
+ * Note: Must be called before esp_mqtt_start.
+ *
+ * @param cb - The in-place callback or NULL to queue all messages.
+ */
+void esp_mqtt_inplace(esp_mqtt_inplace_callback_t cb);
+
 /**
  * Start the MQTT process.
  *
@@ -105,6 +171,93 @@ bool esp_mqtt_unsubscribe(const char *topic);
  */
 bool esp_mqtt_publish(const char *topic, uint8_t *payload, size_t len, int qos, bool retained);
 
+/**
+ * Publish bytes payload to specified topic string.
+ *
+ * Same as `esp_mqtt_publish` but takes a topic with known length, e.g. from a table of precomputed topics.
+ *
+ * @param topic - The topic.
+ * @param payload - The payload.
+ * @param len - The payload length.
+ * @param qos - The qos level.
+ * @param retained - The retained flag.
+ * @return Whether the operation was successful.
+ */
+bool esp_mqtt_publish_topic(lwmqtt_string_t topic, uint8_t *payload, size_t len, int qos, bool retained);
+
+/**
+ * Publish bytes payload with a template prepared by `lwmqtt_prepare_publish`.
+ *
+ * Only the payload and the remaining length are written for each message, the topic is encoded once. The template
+ * buffer is modified, calls with the same template must not overlap.
+ *
+ * @param tpl - The template.
+ * @param payload - The payload.
+ * @param len - The payload length.
+ * @return Whether the operation was successful.
+ */
+bool esp_mqtt_publish_prepared(lwmqtt_publish_template_t *tpl, uint8_t *payload, size_t len);
+
+/**
+ * Publish bytes payload to specified topic string without waiting for the acks.
+ *
+ * QOS 1 and QOS 2 messages stay in flight until the background process has received their acks. Up to
+ * CONFIG_ESP_MQTT_INFLIGHT_WINDOW messages can be in flight at the same time, so a backlog of messages is not limited
+ * to one message per broker round trip. False is also returned if the window is full, in that case the connection is
+ * not affected and the call can be repeated after `esp_mqtt_completed` has increased.
+ *
+ * Note: Messages in flight on a disconnect are not completed anymore.
+ *
+ * @param topic - The topic.
+ * @param payload - The payload.
+ * @param len - The payload length.
+ * @param qos - The qos level.
+ * @param retained - The retained flag.
+ * @return Whether the message was sent.
+ */
+bool esp_mqtt_publish_async(lwmqtt_string_t topic, uint8_t *payload, size_t len, int qos, bool retained);
+
+/**
+ * Get the number of messages published by `esp_mqtt_publish_async` that still wait for their acks.
+ *
+ * @return The number of messages in flight.
+ */
+int esp_mqtt_inflight();
+
+/**
+ * Get the number of messages published by `esp_mqtt_publish_async` that have been acked since boot.
+ *
+ * The broker acks the messages in order, so an increase of the counter completes the oldest messages. Messages lost
+ * by a disconnect are never counted.
+ *
+ * @return The number of acked messages.
+ */
+uint32_t esp_mqtt_completed();
+
+/**
+ * Publish multiple messages with a single socket write.
+ *
+ * The messages are encoded back-to-back into the write buffer and written together, so they usually share one TCP
+ * segment. The write buffer is flushed early if it can't hold all messages. A failed batch is handled like a failed
+ * `esp_mqtt_publish`.
+ *
+ * @param count - The number of messages.
+ * @param topics - The topics.
+ * @param messages - The messages.
+ * @return Whether the operation was successful.
+ */
+bool esp_mqtt_publish_batch(int count, lwmqtt_string_t *topics, lwmqtt_message_t *messages);
+
+/**
+ * Get the statistics of the inbound message path.
+ *
+ * The heap values allow to verify that the heap does not shrink while messages are processed. The socket counters
+ * are summed over all connections since boot.
+ *
+ * @param stats - The statistics.
+ */
+void esp_mqtt_stats(esp_mqtt_stats_t *stats);
+
 /**
  * Stop the MQTT process.
  *
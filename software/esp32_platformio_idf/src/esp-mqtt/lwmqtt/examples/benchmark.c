@@ -0,0 +1,206 @@
+// Host benchmark of the lwmqtt client against an in-process fake broker over a socketpair.
+//
+// Build and run on Linux from the lwmqtt directory:
+//   cc -O2 -Iinclude src/*.c src/os/unix.c examples/benchmark.c -lpthread -o benchmark && ./benchmark
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <lwmqtt.h>
+#include <lwmqtt/unix.h>
+
+#define COMMAND_TIMEOUT 1000
+#define MESSAGES 20000
+#define WINDOW 4
+
+// same shape as the topics of the device
+#define TOPIC "max32/status/30aea4c1d2e4/temperature"
+#define PAYLOAD "21.5"
+
+static int broker_read(int fd, uint8_t *buf, size_t len) {
+  // read exactly len bytes
+  size_t done = 0;
+  while (done < len) {
+    ssize_t r = read(fd, buf + done, len - done);
+    if (r <= 0) {
+      return -1;
+    }
+    done += (size_t)r;
+  }
+
+  return 0;
+}
+
+static void broker_ack(int fd, uint8_t header, uint8_t *id) {
+  // send ack with packet id
+  uint8_t ack[4] = {header, 2, id[0], id[1]};
+  if (write(fd, ack, sizeof(ack)) != sizeof(ack)) {
+    exit(1);
+  }
+}
+
+static void *broker(void *ref) {
+  int fd = *(int *)ref;
+  uint8_t buf[512];
+
+  for (;;) {
+    // read type and remaining length
+    uint8_t header;
+    if (broker_read(fd, &header, 1) < 0) {
+      return NULL;
+    }
+    uint32_t rem_len = 0;
+    uint32_t multiplier = 1;
+    uint8_t byte;
+    do {
+      if (broker_read(fd, &byte, 1) < 0) {
+        return NULL;
+      }
+      rem_len += (byte & 127u) * multiplier;
+      multiplier *= 128;
+    } while (byte & 128u);
+
+    // read body
+    if (rem_len > sizeof(buf) || broker_read(fd, buf, rem_len) < 0) {
+      return NULL;
+    }
+
+    // answer packet
+    switch (header >> 4) {
+      case 1: {  // connect
+        uint8_t connack[4] = {0x20, 2, 0, 0};
+        if (write(fd, connack, sizeof(connack)) != sizeof(connack)) {
+          exit(1);
+        }
+        break;
+      }
+      case 3: {  // publish
+        int qos = (header >> 1) & 3;
+        uint16_t topic_len = (uint16_t)(buf[0] << 8 | buf[1]);
+        if (qos == 1) {
+          broker_ack(fd, 0x40, buf + 2 + topic_len);
+        } else if (qos == 2) {
+          broker_ack(fd, 0x50, buf + 2 + topic_len);
+        }
+        break;
+      }
+      case 6:  // pubrel
+        broker_ack(fd, 0x70, buf);
+        break;
+      case 12: {  // pingreq
+        uint8_t pingresp[2] = {0xD0, 0};
+        if (write(fd, pingresp, sizeof(pingresp)) != sizeof(pingresp)) {
+          exit(1);
+        }
+        break;
+      }
+      case 14:  // disconnect
+        return NULL;
+      default:
+        break;
+    }
+  }
+}
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void check(lwmqtt_err_t err, const char *what) {
+  if (err != LWMQTT_SUCCESS) {
+    printf("%s: %d\n", what, err);
+    exit(1);
+  }
+}
+
+static void run(const char *name, lwmqtt_qos_t qos, bool async, bool buffered) {
+  // create connected socket pair and start broker
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+    exit(1);
+  }
+  pthread_t thread;
+  pthread_create(&thread, NULL, broker, &fds[1]);
+
+  // setup client
+  static uint8_t write_buf[256], read_buf[256];
+  lwmqtt_client_t client;
+  lwmqtt_unix_network_t network = {0};
+  lwmqtt_unix_timer_t timer1, timer2;
+  lwmqtt_inflight_t inflight[WINDOW];
+  lwmqtt_init(&client, write_buf, sizeof(write_buf), read_buf, sizeof(read_buf));
+  lwmqtt_set_network(&client, &network, lwmqtt_unix_network_read, lwmqtt_unix_network_write);
+  lwmqtt_set_timers(&client, &timer1, &timer2, lwmqtt_unix_timer_set, lwmqtt_unix_timer_get);
+  lwmqtt_set_inflight(&client, inflight, WINDOW, NULL, NULL);
+  lwmqtt_set_buffered(&client, buffered);
+  check(lwmqtt_unix_network_open(&network, fds[0]), "lwmqtt_unix_network_open");
+
+  // connect
+  lwmqtt_options_t options = lwmqtt_default_options;
+  options.client_id = lwmqtt_string("30aea4c1d2e4");
+  lwmqtt_return_code_t return_code;
+  check(lwmqtt_connect(&client, options, NULL, &return_code, COMMAND_TIMEOUT), "lwmqtt_connect");
+
+  // measure publishing only
+  lwmqtt_unix_counters_t start = network.counters;
+  lwmqtt_message_t msg = lwmqtt_default_message;
+  msg.qos = qos;
+  msg.payload = (uint8_t *)PAYLOAD;
+  msg.payload_len = strlen(PAYLOAD);
+  lwmqtt_string_t topic = lwmqtt_string(TOPIC);
+  double begin = now();
+
+  for (int i = 0; i < MESSAGES; i++) {
+    if (!async) {
+      check(lwmqtt_publish(&client, topic, msg, COMMAND_TIMEOUT), "lwmqtt_publish");
+      continue;
+    }
+
+    // process acks until the window has space
+    lwmqtt_err_t err;
+    while ((err = lwmqtt_publish_async(&client, topic, msg, NULL, COMMAND_TIMEOUT)) == LWMQTT_INFLIGHT_WINDOW_FULL) {
+      check(lwmqtt_yield(&client, 0, COMMAND_TIMEOUT), "lwmqtt_yield");
+    }
+    check(err, "lwmqtt_publish_async");
+  }
+
+  // wait for outstanding acks
+  while (lwmqtt_inflight_count(&client) > 0) {
+    check(lwmqtt_yield(&client, 0, COMMAND_TIMEOUT), "lwmqtt_yield");
+  }
+
+  double seconds = now() - begin;
+  lwmqtt_unix_counters_t c = network.counters;
+  uint32_t syscalls = (c.reads - start.reads) + (c.writes - start.writes) + (c.polls - start.polls);
+  uint64_t bytes = (c.bytes_read - start.bytes_read) + (c.bytes_written - start.bytes_written);
+
+  printf("%-24s %10.0f msg/s %8.1f bytes/msg %8.2f syscalls/msg\n", name, MESSAGES / seconds,
+         (double)bytes / MESSAGES, (double)syscalls / MESSAGES);
+
+  // disconnect and stop broker
+  check(lwmqtt_disconnect(&client, COMMAND_TIMEOUT), "lwmqtt_disconnect");
+  pthread_join(thread, NULL);
+  lwmqtt_unix_network_disconnect(&network);
+  close(fds[1]);
+}
+
+int main() {
+  printf("%d messages of %zu bytes to \"%s\"\n", MESSAGES, strlen(PAYLOAD), TOPIC);
+
+  run("qos0", LWMQTT_QOS0, false, false);
+  run("qos1", LWMQTT_QOS1, false, false);
+  run("qos1 buffered", LWMQTT_QOS1, false, true);
+  run("qos1 async window 4", LWMQTT_QOS1, true, true);
+  run("qos2", LWMQTT_QOS2, false, false);
+  run("qos2 buffered", LWMQTT_QOS2, false, true);
+  run("qos2 async window 4", LWMQTT_QOS2, true, true);
+
+  return 0;
+}
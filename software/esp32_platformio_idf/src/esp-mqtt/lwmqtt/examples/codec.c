@@ -0,0 +1,244 @@
+// Host micro-benchmark of the lwmqtt packet codecs for the packets exchanged by the device.
+//
+// Build and run on Linux from the lwmqtt directory:
+//   cc -O2 -Iinclude -Isrc src/*.c examples/codec.c -o codec && ./codec
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "packet.h"
+
+#define ROUNDS 1000000
+
+static uint8_t buf[256];
+
+// keeps the results alive
+static volatile uint32_t sink;
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, double begin) {
+  printf("%-32s %8.1f ns/packet\n", name, (now() - begin) * 1e9 / ROUNDS);
+}
+
+static size_t encode(lwmqtt_string_t topic, uint8_t *payload, size_t len, lwmqtt_qos_t qos, bool retained) {
+  lwmqtt_message_t msg = {qos, retained, payload, len};
+  size_t written = 0;
+  lwmqtt_encode_publish(buf, sizeof(buf), &written, false, qos ? 1 : 0, topic, msg);
+  return written;
+}
+
+// the previous varnum codec with a multiply and divide per byte, kept as reference
+static lwmqtt_err_t legacy_read_varnum(uint8_t **buf, const uint8_t *buf_end, uint32_t *varnum) {
+  uint8_t byte;
+  uint32_t multiplier = 1;
+  size_t len = 0;
+  *varnum = 0;
+  do {
+    len++;
+    if ((size_t)(buf_end - (*buf)) < len) {
+      return LWMQTT_BUFFER_TOO_SHORT;
+    }
+    if (len > 4) {
+      return LWMQTT_VARNUM_OVERFLOW;
+    }
+    byte = (*buf)[len - 1];
+    *varnum += (byte & 127) * multiplier;
+    multiplier *= 128;
+  } while ((byte & 128) != 0);
+  *buf += len;
+  return LWMQTT_SUCCESS;
+}
+
+static lwmqtt_err_t legacy_write_varnum(uint8_t **buf, const uint8_t *buf_end, uint32_t varnum) {
+  size_t len = 0;
+  do {
+    if (len == 4) {
+      return LWMQTT_VARNUM_OVERFLOW;
+    }
+    if ((size_t)(buf_end - (*buf)) < len + 1) {
+      return LWMQTT_BUFFER_TOO_SHORT;
+    }
+    uint8_t byte = (uint8_t)(varnum % 128);
+    varnum /= 128;
+    if (varnum > 0) {
+      byte |= 0x80;
+    }
+    (*buf)[len++] = byte;
+  } while (varnum > 0);
+  *buf += len;
+  return LWMQTT_SUCCESS;
+}
+
+// remaining lengths of one to four bytes
+static const uint32_t lengths[4] = {42, 230, 20000, 3000000};
+
+static void bench_varnum(const char *name, lwmqtt_err_t (*write)(uint8_t **, const uint8_t *, uint32_t),
+                         lwmqtt_err_t (*read)(uint8_t **, const uint8_t *, uint32_t *)) {
+  char label[40];
+
+  // encode
+  snprintf(label, sizeof(label), "write varnum %s", name);
+  double begin = now();
+  for (int i = 0; i < ROUNDS; i++) {
+    uint8_t *ptr = buf;
+    write(&ptr, buf + sizeof(buf), lengths[i & 3]);
+    sink += (uint32_t)(ptr - buf);
+  }
+  report(label, begin);
+
+  // decode
+  snprintf(label, sizeof(label), "read varnum %s", name);
+  uint8_t encoded[4][4];
+  for (int j = 0; j < 4; j++) {
+    uint8_t *ptr = encoded[j];
+    write(&ptr, encoded[j] + 4, lengths[j]);
+  }
+  begin = now();
+  for (int i = 0; i < ROUNDS; i++) {
+    uint8_t *ptr = encoded[i & 3];
+    uint32_t varnum;
+    read(&ptr, encoded[i & 3] + 4, &varnum);
+    sink += varnum;
+  }
+  report(label, begin);
+}
+
+int main() {
+  lwmqtt_string_t status = lwmqtt_string("max32/status/30aea4c1d2e4/temperature");
+  lwmqtt_string_t samples = lwmqtt_string("max32/status/30aea4c1d2e4/samples");
+  lwmqtt_string_t command = lwmqtt_string("max32/cmd/30aea4c1d2e4/temperature");
+  uint8_t batch[6 + 32 * 6] = {0};
+  double begin;
+
+  // encode status value (qos 0)
+  begin = now();
+  for (int i = 0; i < ROUNDS; i++) {
+    sink += encode(status, (uint8_t *)"21.5", 4, LWMQTT_QOS0, false);
+  }
+  report("encode publish status", begin);
+
+  // complete status value from a template (qos 0)
+  static uint8_t status_tpl_buf[LWMQTT_PUBLISH_TEMPLATE_HEADER + 2 + 64 + 16];
+  lwmqtt_publish_template_t status_tpl;
+  lwmqtt_prepare_publish(&status_tpl, status_tpl_buf, sizeof(status_tpl_buf), status, LWMQTT_QOS0, false);
+  begin = now();
+  for (int i = 0; i < ROUNDS; i++) {
+    uint8_t *packet;
+    size_t len = 0;
+    lwmqtt_encode_prepared_publish(&status_tpl, 0, (uint8_t *)"21.5", 4, &packet, &len);
+    sink += len;
+  }
+  report("encode publish status template", begin);
+
+  // encode sample batch (qos 1)
+  begin = now();
+  for (int i = 0; i < ROUNDS; i++) {
+    sink += encode(samples, batch, sizeof(batch), LWMQTT_QOS1, false);
+  }
+  report("encode publish samples", begin);
+
+  // encode puback
+  begin = now();
+  for (int i = 0; i < ROUNDS; i++) {
+    size_t written = 0;
+    lwmqtt_encode_ack(buf, sizeof(buf), &written, LWMQTT_PUBACK_PACKET, false, (uint16_t)i);
+    sink += written;
+  }
+  report("encode puback", begin);
+
+  // decode retained command
+  encode(command, (uint8_t *)"19.0", 4, LWMQTT_QOS0, true);
+  begin = now();
+  for (int i = 0; i < ROUNDS; i++) {
+    bool dup;
+    uint16_t packet_id;
+    lwmqtt_string_t topic;
+    lwmqtt_message_t msg;
+    lwmqtt_decode_publish(buf, sizeof(buf), &dup, &packet_id, &topic, &msg);
+    sink += msg.payload_len;
+  }
+  report("decode publish command", begin);
+
+  // decode puback
+  size_t written = 0;
+  lwmqtt_encode_ack(buf, sizeof(buf), &written, LWMQTT_PUBACK_PACKET, false, 7);
+  begin = now();
+  for (int i = 0; i < ROUNDS; i++) {
+    bool dup;
+    uint16_t packet_id;
+    lwmqtt_decode_ack(buf, sizeof(buf), LWMQTT_PUBACK_PACKET, &dup, &packet_id);
+    sink += packet_id;
+  }
+  report("decode puback", begin);
+
+  // decode connack
+  uint8_t connack[] = {0x20, 2, 1, 0};
+  begin = now();
+  for (int i = 0; i < ROUNDS; i++) {
+    bool present;
+    lwmqtt_return_code_t return_code;
+    lwmqtt_decode_connack(connack, sizeof(connack), &present, &return_code);
+    sink += present;
+  }
+  report("decode connack", begin);
+
+  // decode suback
+  uint8_t suback[] = {0x90, 3, 0, 2, 2};
+  begin = now();
+  for (int i = 0; i < ROUNDS; i++) {
+    uint16_t packet_id;
+    int count;
+    lwmqtt_qos_t granted[1];
+    lwmqtt_decode_suback(suback, sizeof(suback), &packet_id, 1, &count, granted);
+    sink += count;
+  }
+  report("decode suback", begin);
+
+  // detect remaining length of the sample batch
+  encode(samples, batch, sizeof(batch), LWMQTT_QOS1, false);
+  begin = now();
+  for (int i = 0; i < ROUNDS; i++) {
+    uint32_t rem_len;
+    lwmqtt_detect_remaining_length(buf + 1, 4, &rem_len);
+    sink += rem_len;
+  }
+  report("detect remaining length", begin);
+
+  // compare varnum codecs
+  bench_varnum("legacy", legacy_write_varnum, legacy_read_varnum);
+  bench_varnum("current", lwmqtt_write_varnum, lwmqtt_read_varnum);
+
+  // parse a four byte header as it arrives, restarting the detection per byte as before
+  uint8_t header[4] = {0xC0, 0x8D, 0xB7, 0x01};
+  begin = now();
+  for (int i = 0; i < ROUNDS; i++) {
+    uint32_t rem_len = 0;
+    size_t len = 0;
+    lwmqtt_err_t err;
+    do {
+      len++;
+      err = lwmqtt_detect_remaining_length(header, len, &rem_len);
+    } while (err == LWMQTT_BUFFER_TOO_SHORT && len < sizeof(header));
+    sink += rem_len;
+  }
+  report("header per byte restart", begin);
+
+  // parse the same header with the incremental decoder
+  begin = now();
+  for (int i = 0; i < ROUNDS; i++) {
+    lwmqtt_varnum_decoder_t decoder = lwmqtt_default_varnum_decoder;
+    size_t len = 0;
+    while (lwmqtt_varnum_decoder_feed(&decoder, header[len++]) == LWMQTT_BUFFER_TOO_SHORT) {
+    }
+    sink += decoder.varnum;
+  }
+  report("header incremental", begin);
+
+  return 0;
+}
@@ -0,0 +1,258 @@
+// Host fuzz harness of the lwmqtt decoders and both read paths of the client.
+//
+// Every input is decoded as each packet type, the remaining length is detected and the input is read by the client
+// in the unbuffered and the buffered mode, split into chunks of varying size like a socket would deliver it.
+//
+// Build and run on Linux from the lwmqtt directory, checks the regression inputs and then runs random mutations
+// (pass files to replay them instead):
+//   cc -g -O1 -fsanitize=address,undefined -fno-sanitize-recover=all -Iinclude -Isrc src/*.c examples/fuzz.c -o fuzz && ./fuzz
+//
+// Build as libFuzzer target:
+//   clang -g -O1 -fsanitize=fuzzer,address,undefined -fno-sanitize-recover=all -DFUZZ_LIBFUZZER -Iinclude -Isrc src/*.c examples/fuzz.c -o fuzz
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "helpers.h"
+#include "packet.h"
+
+#define BUF_SIZE 256
+#define MAX_INPUT 600
+#define ROUNDS 2000000
+
+// inputs that crashed or misbehaved before the decoders were hardened
+typedef struct {
+  const char *name;
+  uint8_t data[8];
+  size_t len;
+} regression_t;
+
+static const regression_t regressions[] = {
+    // suback with two return codes, written past a table of one
+    {"suback count", {0x90, 0x04, 0x00, 0x01, 0x01, 0x01}, 6},
+    // qos 1 publish with dup and retain, the flag masks left-shifted a negative int
+    {"publish flags", {0x3B, 0x06, 0x00, 0x01, 't', 0x00, 0x05, 'x'}, 8},
+    // header with the largest three byte remaining length, its length was reported as four bytes
+    {"varnum length", {0x30, 0xFF, 0xFF, 0x7F}, 4},
+};
+
+// network input of the client
+static const uint8_t *net_data;
+static size_t net_len, net_pos;
+static uint32_t net_seed;
+
+// keeps the results alive
+static volatile uint32_t sink;
+
+static lwmqtt_err_t net_read(void *ref, uint8_t *buf, size_t len, size_t *read, uint32_t timeout) {
+  // closed connection at the end of the input
+  if (net_pos >= net_len) {
+    return LWMQTT_NETWORK_FAILED_READ;
+  }
+
+  // deliver a chunk of pseudo random size
+  net_seed = net_seed * 1664525u + 1013904223u;
+  size_t n = 1 + (net_seed >> 16) % 40;
+  if (n > len) {
+    n = len;
+  }
+  if (n > net_len - net_pos) {
+    n = net_len - net_pos;
+  }
+
+  memcpy(buf, net_data + net_pos, n);
+  net_pos += n;
+  *read += n;
+
+  return LWMQTT_SUCCESS;
+}
+
+static lwmqtt_err_t net_write(void *ref, uint8_t *buf, size_t len, size_t *sent, uint32_t timeout) {
+  *sent += len;
+  return LWMQTT_SUCCESS;
+}
+
+static void timer_set(void *ref, uint32_t timeout) {}
+
+static int32_t timer_get(void *ref) { return 1000; }
+
+static void callback(lwmqtt_client_t *client, void *ref, lwmqtt_string_t topic, lwmqtt_message_t msg) {
+  // touch all bytes to catch reads outside of the buffer
+  for (size_t i = 0; i < topic.len; i++) {
+    sink += (uint8_t)topic.data[i];
+  }
+  for (size_t i = 0; i < msg.payload_len; i++) {
+    sink += msg.payload[i];
+  }
+}
+
+static void read_client(const uint8_t *data, size_t len, bool buffered) {
+  static uint8_t write_buf[BUF_SIZE], read_buf[BUF_SIZE];
+  lwmqtt_client_t client;
+  int timer;
+
+  lwmqtt_init(&client, write_buf, BUF_SIZE, read_buf, BUF_SIZE);
+  lwmqtt_set_network(&client, NULL, net_read, net_write);
+  lwmqtt_set_timers(&client, &timer, &timer, timer_set, timer_get);
+  lwmqtt_set_callback(&client, NULL, callback);
+  lwmqtt_set_buffered(&client, buffered);
+
+  net_data = data;
+  net_len = len;
+  net_pos = 0;
+  net_seed = (uint32_t)len;
+
+  // yield till the input is consumed or rejected
+  for (int i = 0; i < 32; i++) {
+    sink += lwmqtt_buffered_packet(&client);
+    if (lwmqtt_yield(&client, 0, 1000) != LWMQTT_SUCCESS) {
+      break;
+    }
+  }
+}
+
+static void fuzz_one(const uint8_t *data, size_t len) {
+  // exact copy, so reads past the input are detected
+  uint8_t *buf = malloc(len > 0 ? len : 1);
+  memcpy(buf, data, len);
+
+  bool flag;
+  uint16_t packet_id;
+  uint32_t rem_len;
+  lwmqtt_packet_type_t packet_type;
+  lwmqtt_return_code_t return_code;
+  lwmqtt_string_t topic;
+  lwmqtt_message_t msg;
+
+  lwmqtt_detect_packet_type(buf, len, &packet_type);
+  lwmqtt_detect_remaining_length(buf, len, &rem_len);
+  if (len > 1) {
+    lwmqtt_detect_remaining_length(buf + 1, len - 1, &rem_len);
+  }
+  lwmqtt_decode_connack(buf, len, &flag, &return_code);
+  lwmqtt_decode_ack(buf, len, LWMQTT_PUBACK_PACKET, &flag, &packet_id);
+  lwmqtt_decode_ack(buf, len, LWMQTT_PUBREC_PACKET, &flag, &packet_id);
+  lwmqtt_decode_ack(buf, len, LWMQTT_PUBREL_PACKET, &flag, &packet_id);
+  lwmqtt_decode_ack(buf, len, LWMQTT_PUBCOMP_PACKET, &flag, &packet_id);
+  lwmqtt_decode_ack(buf, len, LWMQTT_UNSUBACK_PACKET, &flag, &packet_id);
+  if (lwmqtt_decode_publish(buf, len, &flag, &packet_id, &topic, &msg) == LWMQTT_SUCCESS) {
+    callback(NULL, NULL, topic, msg);
+  }
+
+  // the guard entry must never be written
+  lwmqtt_qos_t granted[3] = {0, 0, (lwmqtt_qos_t)0x55};
+  int count;
+  lwmqtt_decode_suback(buf, len, &packet_id, 2, &count, granted);
+  if (granted[2] != (lwmqtt_qos_t)0x55) {
+    fprintf(stderr, "lwmqtt_decode_suback wrote past the table\n");
+    abort();
+  }
+
+  read_client(buf, len, false);
+  read_client(buf, len, true);
+
+  free(buf);
+}
+
+#ifdef FUZZ_LIBFUZZER
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  fuzz_one(data, size);
+  return 0;
+}
+
+#else
+
+static void check(bool ok, const char *what) {
+  if (!ok) {
+    fprintf(stderr, "check failed: %s\n", what);
+    exit(1);
+  }
+}
+
+static void run_regressions() {
+  int len;
+
+  // the fixed helpers directly
+  check(lwmqtt_read_bits(0x3B, 1, 2) == 1, "lwmqtt_read_bits");
+  uint8_t byte = 0xFF;
+  lwmqtt_write_bits(&byte, 0, 1, 2);
+  check(byte == 0xF9, "lwmqtt_write_bits");
+  check(lwmqtt_varnum_length(2097151, &len) == LWMQTT_SUCCESS && len == 3, "lwmqtt_varnum_length 2097151");
+  check(lwmqtt_varnum_length(268435455, &len) == LWMQTT_SUCCESS && len == 4, "lwmqtt_varnum_length 268435455");
+
+  // the crashing inputs through all paths
+  for (size_t i = 0; i < sizeof(regressions) / sizeof(regressions[0]); i++) {
+    fuzz_one(regressions[i].data, regressions[i].len);
+    printf("regression %-16s ok\n", regressions[i].name);
+  }
+
+  // the suback must be rejected instead of overflowing the table
+  uint16_t packet_id;
+  int count;
+  lwmqtt_qos_t granted[1];
+  check(lwmqtt_decode_suback((uint8_t *)regressions[0].data, regressions[0].len, &packet_id, 1, &count, granted) !=
+            LWMQTT_SUCCESS,
+        "lwmqtt_decode_suback max count");
+}
+
+static void replay(const char *path) {
+  static uint8_t data[64 * 1024];
+
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    perror(path);
+    exit(1);
+  }
+
+  size_t len = fread(data, 1, sizeof(data), f);
+  fclose(f);
+
+  fuzz_one(data, len);
+  printf("replayed %s (%zu bytes)\n", path, len);
+}
+
+// random input, mostly with a valid packet type and a plausible remaining length
+static size_t mutate(uint8_t *data) {
+  size_t len = 1 + (size_t)rand() % MAX_INPUT;
+
+  for (size_t i = 0; i < len; i++) {
+    data[i] = (uint8_t)rand();
+  }
+
+  if (rand() % 2) {
+    data[0] = (uint8_t)((1 + rand() % 14) << 4 | rand() % 16);
+  }
+
+  if (len > 1 && rand() % 2) {
+    data[1] = (uint8_t)(rand() % len % 128);
+  }
+
+  return len;
+}
+
+int main(int argc, char **argv) {
+  run_regressions();
+
+  // replay given inputs only
+  if (argc > 1) {
+    for (int i = 1; i < argc; i++) {
+      replay(argv[i]);
+    }
+    return 0;
+  }
+
+  static uint8_t data[MAX_INPUT];
+  srand(1);
+
+  for (long i = 0; i < ROUNDS; i++) {
+    fuzz_one(data, mutate(data));
+  }
+
+  printf("%d random inputs ok\n", ROUNDS);
+
+  return 0;
+}
+
+#endif
@@ -23,6 +23,7 @@ typedef enum {
   LWMQTT_FAILED_SUBSCRIPTION = -11,
   LWMQTT_SUBACK_ARRAY_OVERFLOW = -12,
   LWMQTT_PONG_TIMEOUT = -13,
+  LWMQTT_INFLIGHT_WINDOW_FULL = -14,
 } lwmqtt_err_t;
 
 /**
@@ -77,6 +78,42 @@ typedef struct {
 #define lwmqtt_default_message \
   { LWMQTT_QOS0, false, NULL, 0 }
 
+/**
+ * The bytes reserved in front of the topic of a publish template for the fixed header.
+ */
+#define LWMQTT_PUBLISH_TEMPLATE_HEADER 5
+
+/**
+ * A publish packet for a fixed topic, QOS level and retained flag that has been encoded in advance.
+ *
+ * The buffer holds the encoded topic behind the room for the fixed header. Publishing only writes the payload, the
+ * packet id and the remaining length around it.
+ */
+typedef struct {
+  uint8_t *buf;
+  size_t buf_size;
+  size_t topic_len;
+  uint8_t header;
+  lwmqtt_qos_t qos;
+} lwmqtt_publish_template_t;
+
+/**
+ * Will encode the fixed header flags and the topic of a publish template.
+ *
+ * The buffer must hold LWMQTT_PUBLISH_TEMPLATE_HEADER bytes, the topic with its length prefix, two bytes for the
+ * packet id if the QOS level is at least 1 and the largest payload. It must stay valid as long as the template is used.
+ *
+ * @param tpl - The template object.
+ * @param buf - The buffer of the template.
+ * @param buf_size - The size of the buffer.
+ * @param topic - The topic.
+ * @param qos - The QOS level.
+ * @param retained - The retained flag.
+ * @return An error value.
+ */
+lwmqtt_err_t lwmqtt_prepare_publish(lwmqtt_publish_template_t *tpl, uint8_t *buf, size_t buf_size,
+                                    lwmqtt_string_t topic, lwmqtt_qos_t qos, bool retained);
+
 /**
  * Forward declaration of the client object.
  */
@@ -137,6 +174,31 @@ typedef int32_t (*lwmqtt_timer_get_t)(void *ref);
  */
 typedef void (*lwmqtt_callback_t)(lwmqtt_client_t *client, void *ref, lwmqtt_string_t str, lwmqtt_message_t msg);
 
+/**
+ * The states of an asynchronously published message.
+ */
+typedef enum {
+  LWMQTT_INFLIGHT_FREE = 0,
+  LWMQTT_INFLIGHT_AWAIT_PUBACK,
+  LWMQTT_INFLIGHT_AWAIT_PUBREC,
+  LWMQTT_INFLIGHT_AWAIT_PUBCOMP
+} lwmqtt_inflight_state_t;
+
+/**
+ * An entry of the in-flight table.
+ */
+typedef struct {
+  uint16_t packet_id;
+  lwmqtt_inflight_state_t state;
+} lwmqtt_inflight_t;
+
+/**
+ * The callback used to signal that an asynchronously published message has been acked.
+ *
+ * Note: The callback is executed as part of the call that reads the final ack from the network.
+ */
+typedef void (*lwmqtt_inflight_callback_t)(lwmqtt_client_t *client, void *ref, uint16_t packet_id);
+
 /**
  * The client object.
  */
@@ -144,13 +206,22 @@ struct lwmqtt_client_t {
   uint16_t last_packet_id;
   uint32_t keep_alive_interval;
   bool pong_pending;
+  bool session_present;
 
   size_t write_buf_size, read_buf_size;
   uint8_t *write_buf, *read_buf;
 
+  bool buffered;
+  size_t read_buf_used, read_buf_packet;
+
   lwmqtt_callback_t callback;
   void *callback_ref;
 
+  lwmqtt_inflight_t *inflight;
+  int inflight_size;
+  lwmqtt_inflight_callback_t inflight_callback;
+  void *inflight_callback_ref;
+
   void *network;
   lwmqtt_network_read_t network_read;
   lwmqtt_network_write_t network_write;
@@ -204,6 +275,57 @@ void lwmqtt_set_timers(lwmqtt_client_t *client, void *keep_alive_timer, void *co
  */
 void lwmqtt_set_callback(lwmqtt_client_t *client, void *ref, lwmqtt_callback_t cb);
 
+/**
+ * Will enable or disable the buffered read mode.
+ *
+ * In buffered mode the client reads as many bytes as the network provides, up to the size of the read buffer, and
+ * parses the packets from that chunk. Bytes following the current packet are kept and parsed by the next cycle, so
+ * packets sent together by the broker (e.g. CONNACK, SUBACK and retained messages) are processed with a single read.
+ *
+ * Note: The network read callback must return early with the available bytes instead of waiting to fill the buffer.
+ *
+ * @param client - The client object.
+ * @param buffered - The buffered mode flag.
+ */
+void lwmqtt_set_buffered(lwmqtt_client_t *client, bool buffered);
+
+/**
+ * Will return the amount of bytes that have been read in buffered mode but not yet processed.
+ *
+ * These bytes are not reported anymore by the network, so a caller that waits for incoming data should call
+ * lwmqtt_yield() first if this is not zero.
+ *
+ * @param client - The client object.
+ * @return The amount of buffered bytes.
+ */
+size_t lwmqtt_buffered(lwmqtt_client_t *client);
+
+/**
+ * Will return whether the bytes read in buffered mode but not yet processed contain a complete packet.
+ *
+ * Only then lwmqtt_yield() can process them without waiting for the network. A malformed header is reported as
+ * complete, so the following lwmqtt_yield() returns the error.
+ *
+ * @param client - The client object.
+ * @return Whether a complete packet is buffered.
+ */
+bool lwmqtt_buffered_packet(lwmqtt_client_t *client);
+
+/**
+ * Will set the in-flight table used by lwmqtt_publish_async().
+ *
+ * The size of the table is the window of QOS 1 and QOS 2 messages that may wait for their acks at the same time. All
+ * entries are cleared, so messages still in flight from a previous connection are not completed anymore.
+ *
+ * @param client - The client object.
+ * @param table - The table.
+ * @param size - The number of table entries.
+ * @param ref - A custom reference that will passed to the callback.
+ * @param cb - The callback to be called when a message has been acked. May be NULL.
+ */
+void lwmqtt_set_inflight(lwmqtt_client_t *client, lwmqtt_inflight_t *table, int size, void *ref,
+                         lwmqtt_inflight_callback_t cb);
+
 /**
  * The object defining the last will of a client.
  */
@@ -266,6 +388,14 @@ typedef enum {
 lwmqtt_err_t lwmqtt_connect(lwmqtt_client_t *client, lwmqtt_options_t options, lwmqtt_will_t *will,
                             lwmqtt_return_code_t *return_code, uint32_t timeout);
 
+/**
+ * Will return the session present flag of the last CONNACK packet received by lwmqtt_connect.
+ *
+ * @param client - The client object.
+ * @return Whether the broker resumed an existing session.
+ */
+bool lwmqtt_session_present(lwmqtt_client_t *client);
+
 /**
  * Will send a publish packet and wait for all acks to complete.
  *
@@ -279,6 +409,76 @@ lwmqtt_err_t lwmqtt_connect(lwmqtt_client_t *client, lwmqtt_options_t options, l
  */
 lwmqtt_err_t lwmqtt_publish(lwmqtt_client_t *client, lwmqtt_string_t topic, lwmqtt_message_t msg, uint32_t timeout);
 
+/**
+ * Will send a publish packet of a template and wait for all acks to complete.
+ *
+ * The packet is completed in the buffer of the template and written from there, the write buffer is not used.
+ *
+ * Note: The message callback might be called with incoming messages as part of this call.
+ *
+ * @param client - The client object.
+ * @param tpl - The template object.
+ * @param payload - The payload.
+ * @param payload_len - The length of the payload.
+ * @param timeout - The command timeout.
+ * @return An error value.
+ */
+lwmqtt_err_t lwmqtt_publish_prepared(lwmqtt_client_t *client, lwmqtt_publish_template_t *tpl, uint8_t *payload,
+                                     size_t payload_len, uint32_t timeout);
+
+/**
+ * Will send a publish packet without waiting for the acks.
+ *
+ * QOS 1 and QOS 2 messages occupy an entry of the in-flight table until their acks have been processed by a following
+ * lwmqtt_yield() or any other call that reads from the network. Acks of in-flight messages are consumed there and never
+ * complete a blocking command that is waiting at the same time. QOS 0 messages are sent like with lwmqtt_publish().
+ *
+ * @param client - The client object.
+ * @param topic - The topic.
+ * @param message - The message.
+ * @param packet_id - The variable that will receive the packet id, zero for QOS 0. May be NULL.
+ * @param timeout - The command timeout.
+ * @return An error value, LWMQTT_INFLIGHT_WINDOW_FULL if no table entry is free.
+ */
+lwmqtt_err_t lwmqtt_publish_async(lwmqtt_client_t *client, lwmqtt_string_t topic, lwmqtt_message_t msg,
+                                  uint16_t *packet_id, uint32_t timeout);
+
+/**
+ * Will return the number of asynchronously published messages that still wait for their acks.
+ *
+ * @param client - The client object.
+ * @return The number of messages in flight.
+ */
+int lwmqtt_inflight_count(lwmqtt_client_t *client);
+
+/**
+ * Will check if an asynchronously published message still waits for its acks.
+ *
+ * @param client - The client object.
+ * @param packet_id - The packet id returned by lwmqtt_publish_async().
+ * @return Whether the message is still in flight.
+ */
+bool lwmqtt_inflight_pending(lwmqtt_client_t *client, uint16_t packet_id);
+
+/**
+ * Will send multiple publish packets and wait for all acks to complete.
+ *
+ * The packets are encoded back-to-back into the write buffer and sent with a single write. If the write buffer is
+ * full, the encoded packets are written and encoding continues at the start of the buffer. The keep alive timer is
+ * reset once for the whole batch.
+ *
+ * Note: The message callback might be called with incoming messages as part of this call.
+ *
+ * @param client - The client object.
+ * @param count - The number of messages.
+ * @param topics - The topics.
+ * @param messages - The messages.
+ * @param timeout - The command timeout.
+ * @return An error value.
+ */
+lwmqtt_err_t lwmqtt_publish_batch(lwmqtt_client_t *client, int count, lwmqtt_string_t *topics,
+                                  lwmqtt_message_t *messages, uint32_t timeout);
+
 /**
  * Will send a subscribe packet with multiple topic filters plus QOS levels and wait for the suback to complete.
  *
@@ -0,0 +1,79 @@
+#ifndef LWMQTT_UNIX_H
+#define LWMQTT_UNIX_H
+
+#include <sys/time.h>
+
+#include "../lwmqtt.h"
+
+/**
+ * The lwmqtt timer object for unix systems.
+ */
+typedef struct {
+  struct timeval end;
+} lwmqtt_unix_timer_t;
+
+/**
+ * The lwmqtt timer set callback for unix systems.
+ */
+void lwmqtt_unix_timer_set(void *ref, uint32_t timeout);
+
+/**
+ * The lwmqtt timer get callback for unix systems.
+ */
+int32_t lwmqtt_unix_timer_get(void *ref);
+
+/**
+ * The system call and byte counters of a network object.
+ */
+typedef struct {
+  uint32_t reads;
+  uint32_t writes;
+  uint32_t polls;
+  uint64_t bytes_read;
+  uint64_t bytes_written;
+} lwmqtt_unix_counters_t;
+
+/**
+ * The lwmqtt network object for unix systems.
+ */
+typedef struct {
+  int socket;
+  lwmqtt_unix_counters_t counters;
+} lwmqtt_unix_network_t;
+
+/**
+ * Initiate a connection to the specified remote host.
+ */
+lwmqtt_err_t lwmqtt_unix_network_connect(lwmqtt_unix_network_t *network, char *host, int port);
+
+/**
+ * Use an already connected socket, e.g. one end of a socketpair.
+ */
+lwmqtt_err_t lwmqtt_unix_network_open(lwmqtt_unix_network_t *network, int socket);
+
+/**
+ * Terminate the connection.
+ */
+void lwmqtt_unix_network_disconnect(lwmqtt_unix_network_t *network);
+
+/**
+ * Will set available to the available amount of data in the underlying network buffer.
+ */
+lwmqtt_err_t lwmqtt_unix_network_peek(lwmqtt_unix_network_t *network, size_t *available);
+
+/**
+ * Will wait for a socket until data is available or the timeout has been reached.
+ */
+lwmqtt_err_t lwmqtt_unix_network_select(lwmqtt_unix_network_t *network, bool *available, uint32_t timeout);
+
+/**
+ * The lwmqtt network read callback for unix systems.
+ */
+lwmqtt_err_t lwmqtt_unix_network_read(void *ref, uint8_t *buf, size_t len, size_t *read, uint32_t timeout);
+
+/**
+ * The lwmqtt network write callback for unix systems.
+ */
+lwmqtt_err_t lwmqtt_unix_network_write(void *ref, uint8_t *buf, size_t len, size_t *sent, uint32_t timeout);
+
+#endif  // LWMQTT_UNIX_H
@@ -1,3 +1,5 @@
+#include <string.h>
+
 #include "packet.h"
 
 void lwmqtt_init(lwmqtt_client_t *client, uint8_t *write_buf, size_t write_buf_size, uint8_t *read_buf,
@@ -5,15 +7,25 @@ void lwmqtt_init(lwmqtt_client_t *client, uint8_t *write_buf, size_t write_buf_s
   client->last_packet_id = 1;
   client->keep_alive_interval = 0;
   client->pong_pending = false;
+  client->session_present = false;
 
   client->write_buf = write_buf;
   client->write_buf_size = write_buf_size;
   client->read_buf = read_buf;
   client->read_buf_size = read_buf_size;
 
+  client->buffered = false;
+  client->read_buf_used = 0;
+  client->read_buf_packet = 0;
+
   client->callback = NULL;
   client->callback_ref = NULL;
 
+  client->inflight = NULL;
+  client->inflight_size = 0;
+  client->inflight_callback = NULL;
+  client->inflight_callback_ref = NULL;
+
   client->network = NULL;
   client->network_read = NULL;
   client->network_write = NULL;
@@ -46,6 +58,69 @@ void lwmqtt_set_callback(lwmqtt_client_t *client, void *ref, lwmqtt_callback_t c
   client->callback = cb;
 }
 
+void lwmqtt_set_buffered(lwmqtt_client_t *client, bool buffered) {
+  client->buffered = buffered;
+  client->read_buf_used = 0;
+  client->read_buf_packet = 0;
+}
+
+size_t lwmqtt_buffered(lwmqtt_client_t *client) { return client->read_buf_used - client->read_buf_packet; }
+
+bool lwmqtt_buffered_packet(lwmqtt_client_t *client) {
+  // get unprocessed bytes
+  uint8_t *buf = client->read_buf + client->read_buf_packet;
+  size_t len = lwmqtt_buffered(client);
+
+  // a header needs at least two bytes
+  if (len < 2) {
+    return false;
+  }
+
+  // detect remaining length, a malformed header is reported by the next yield
+  uint32_t rem_len = 0;
+  lwmqtt_err_t err = lwmqtt_detect_remaining_length(buf + 1, len - 1, &rem_len);
+  if (err == LWMQTT_BUFFER_TOO_SHORT) {
+    return false;
+  } else if (err != LWMQTT_SUCCESS) {
+    return true;
+  }
+
+  // get length of the remaining length field
+  int rem_len_len;
+  err = lwmqtt_varnum_length(rem_len, &rem_len_len);
+  if (err != LWMQTT_SUCCESS) {
+    return true;
+  }
+
+  return len >= 1 + (size_t)rem_len_len + rem_len;
+}
+
+void lwmqtt_set_inflight(lwmqtt_client_t *client, lwmqtt_inflight_t *table, int size, void *ref,
+                         lwmqtt_inflight_callback_t cb) {
+  client->inflight = table;
+  client->inflight_size = size;
+  client->inflight_callback_ref = ref;
+  client->inflight_callback = cb;
+
+  // clear all entries
+  for (int i = 0; i < size; i++) {
+    table[i].packet_id = 0;
+    table[i].state = LWMQTT_INFLIGHT_FREE;
+  }
+}
+
+static lwmqtt_inflight_t *lwmqtt_inflight_find(lwmqtt_client_t *client, uint16_t packet_id,
+                                               lwmqtt_inflight_state_t state) {
+  // search entry with matching id and state
+  for (int i = 0; i < client->inflight_size; i++) {
+    if (client->inflight[i].state == state && client->inflight[i].packet_id == packet_id) {
+      return &client->inflight[i];
+    }
+  }
+
+  return NULL;
+}
+
 static uint16_t lwmqtt_get_next_packet_id(lwmqtt_client_t *client) {
   // check overflow
   if (client->last_packet_id == 65535) {
@@ -91,7 +166,7 @@ static lwmqtt_err_t lwmqtt_read_from_network(lwmqtt_client_t *client, size_t off
   return LWMQTT_SUCCESS;
 }
 
-static lwmqtt_err_t lwmqtt_write_to_network(lwmqtt_client_t *client, size_t offset, size_t len) {
+static lwmqtt_err_t lwmqtt_write_to_network(lwmqtt_client_t *client, uint8_t *buf, size_t len) {
   // prepare counter
   size_t written = 0;
 
@@ -105,8 +180,8 @@ static lwmqtt_err_t lwmqtt_write_to_network(lwmqtt_client_t *client, size_t offs
 
     // write
     size_t partial_write = 0;
-    lwmqtt_err_t err = client->network_write(client->network, client->write_buf + offset + written, len - written,
-                                             &partial_write, (uint32_t)remaining_time);
+    lwmqtt_err_t err = client->network_write(client->network, buf + written, len - written, &partial_write,
+                                             (uint32_t)remaining_time);
     if (err != LWMQTT_SUCCESS) {
       return err;
     }
@@ -140,7 +215,7 @@ static lwmqtt_err_t lwmqtt_read_packet_in_buffer(lwmqtt_client_t *client, size_t
 
   // prepare variables
   size_t len = 0;
-  uint32_t rem_len = 0;
+  lwmqtt_varnum_decoder_t decoder = lwmqtt_default_varnum_decoder;
 
   do {
     // adjust len
@@ -152,15 +227,20 @@ static lwmqtt_err_t lwmqtt_read_packet_in_buffer(lwmqtt_client_t *client, size_t
       return err;
     }
 
-    // attempt to detect remaining length
-    err = lwmqtt_detect_remaining_length(client->read_buf + 1, len, &rem_len);
+    // continue decoding the remaining length with the new byte
+    err = lwmqtt_varnum_decoder_feed(&decoder, client->read_buf[len]);
   } while (err == LWMQTT_BUFFER_TOO_SHORT);
 
   // check final error
-  if (err != LWMQTT_SUCCESS) {
+  if (err == LWMQTT_VARNUM_OVERFLOW) {
+    return LWMQTT_REMAINING_LENGTH_OVERFLOW;
+  } else if (err != LWMQTT_SUCCESS) {
     return err;
   }
 
+  // get remaining length
+  uint32_t rem_len = decoder.varnum;
+
   // read the rest of the buffer if needed
   if (rem_len > 0) {
     err = lwmqtt_read_from_network(client, 1 + len, rem_len);
@@ -175,9 +255,86 @@ static lwmqtt_err_t lwmqtt_read_packet_in_buffer(lwmqtt_client_t *client, size_t
   return LWMQTT_SUCCESS;
 }
 
-static lwmqtt_err_t lwmqtt_send_packet_in_buffer(lwmqtt_client_t *client, size_t length) {
+static lwmqtt_err_t lwmqtt_read_chunk_in_buffer(lwmqtt_client_t *client, size_t *read,
+                                                lwmqtt_packet_type_t *packet_type) {
+  // preset packet type
+  *packet_type = LWMQTT_NO_PACKET;
+
+  // discard the previous packet and move leftover bytes to the start
+  if (client->read_buf_packet > 0) {
+    client->read_buf_used -= client->read_buf_packet;
+    memmove(client->read_buf, client->read_buf + client->read_buf_packet, client->read_buf_used);
+    client->read_buf_packet = 0;
+  }
+
+  for (;;) {
+    // attempt to detect a complete packet in the buffered bytes
+    if (client->read_buf_used > 1) {
+      uint32_t rem_len = 0;
+      lwmqtt_err_t err = lwmqtt_detect_remaining_length(client->read_buf + 1, client->read_buf_used - 1, &rem_len);
+      if (err != LWMQTT_SUCCESS && err != LWMQTT_BUFFER_TOO_SHORT) {
+        return err;
+      }
+
+      // check if the packet is complete
+      if (err == LWMQTT_SUCCESS) {
+        int rem_len_len;
+        err = lwmqtt_varnum_length(rem_len, &rem_len_len);
+        if (err != LWMQTT_SUCCESS) {
+          return err;
+        }
+
+        // fail early if the packet will never fit
+        size_t packet_len = 1 + (size_t)rem_len_len + rem_len;
+        if (packet_len > client->read_buf_size) {
+          return LWMQTT_BUFFER_TOO_SHORT;
+        }
+
+        if (client->read_buf_used >= packet_len) {
+          // detect packet type
+          err = lwmqtt_detect_packet_type(client->read_buf, 1, packet_type);
+          if (err != LWMQTT_SUCCESS) {
+            return err;
+          }
+
+          // keep packet until the next read
+          client->read_buf_packet = packet_len;
+          *read += packet_len;
+
+          return LWMQTT_SUCCESS;
+        }
+      }
+    }
+
+    // check read buffer capacity
+    if (client->read_buf_used == client->read_buf_size) {
+      return LWMQTT_BUFFER_TOO_SHORT;
+    }
+
+    // check remaining time
+    int32_t remaining_time = client->timer_get(client->command_timer);
+    if (remaining_time <= 0) {
+      // this is ok as no data has been read at all
+      return client->read_buf_used == 0 ? LWMQTT_SUCCESS : LWMQTT_NETWORK_TIMEOUT;
+    }
+
+    // read as many bytes as available
+    size_t partial_read = 0;
+    lwmqtt_err_t err =
+        client->network_read(client->network, client->read_buf + client->read_buf_used,
+                             client->read_buf_size - client->read_buf_used, &partial_read, (uint32_t)remaining_time);
+    if (err != LWMQTT_SUCCESS) {
+      return err;
+    }
+
+    // increment counter
+    client->read_buf_used += partial_read;
+  }
+}
+
+static lwmqtt_err_t lwmqtt_send_packet(lwmqtt_client_t *client, uint8_t *buf, size_t length) {
   // write to network
-  lwmqtt_err_t err = lwmqtt_write_to_network(client, 0, length);
+  lwmqtt_err_t err = lwmqtt_write_to_network(client, buf, length);
   if (err != LWMQTT_SUCCESS) {
     return err;
   }
@@ -188,9 +345,14 @@ static lwmqtt_err_t lwmqtt_send_packet_in_buffer(lwmqtt_client_t *client, size_t
   return LWMQTT_SUCCESS;
 }
 
+static lwmqtt_err_t lwmqtt_send_packet_in_buffer(lwmqtt_client_t *client, size_t length) {
+  return lwmqtt_send_packet(client, client->write_buf, length);
+}
+
 static lwmqtt_err_t lwmqtt_cycle(lwmqtt_client_t *client, size_t *read, lwmqtt_packet_type_t *packet_type) {
   // read next packet from the network
-  lwmqtt_err_t err = lwmqtt_read_packet_in_buffer(client, read, packet_type);
+  lwmqtt_err_t err = client->buffered ? lwmqtt_read_chunk_in_buffer(client, read, packet_type)
+                                      : lwmqtt_read_packet_in_buffer(client, read, packet_type);
   if (err != LWMQTT_SUCCESS) {
     return err;
   } else if (*packet_type == LWMQTT_NO_PACKET) {
@@ -254,6 +416,13 @@ static lwmqtt_err_t lwmqtt_cycle(lwmqtt_client_t *client, size_t *read, lwmqtt_p
         return err;
       }
 
+      // advance in-flight message and hide ack from blocking commands
+      lwmqtt_inflight_t *entry = lwmqtt_inflight_find(client, packet_id, LWMQTT_INFLIGHT_AWAIT_PUBREC);
+      if (entry != NULL) {
+        entry->state = LWMQTT_INFLIGHT_AWAIT_PUBCOMP;
+        *packet_type = LWMQTT_NO_PACKET;
+      }
+
       // encode pubrel packet
       size_t len;
       err = lwmqtt_encode_ack(client->write_buf, client->write_buf_size, &len, LWMQTT_PUBREL_PACKET, 0, packet_id);
@@ -296,6 +465,35 @@ static lwmqtt_err_t lwmqtt_cycle(lwmqtt_client_t *client, size_t *read, lwmqtt_p
       break;
     }
 
+    // handle puback and pubcomp packets
+    case LWMQTT_PUBACK_PACKET:
+    case LWMQTT_PUBCOMP_PACKET: {
+      // decode ack packet
+      bool dup;
+      uint16_t packet_id;
+      err = lwmqtt_decode_ack(client->read_buf, client->read_buf_size, *packet_type, &dup, &packet_id);
+      if (err != LWMQTT_SUCCESS) {
+        return err;
+      }
+
+      // complete in-flight message and hide ack from blocking commands
+      lwmqtt_inflight_state_t state =
+          *packet_type == LWMQTT_PUBACK_PACKET ? LWMQTT_INFLIGHT_AWAIT_PUBACK : LWMQTT_INFLIGHT_AWAIT_PUBCOMP;
+      lwmqtt_inflight_t *entry = lwmqtt_inflight_find(client, packet_id, state);
+      if (entry != NULL) {
+        entry->packet_id = 0;
+        entry->state = LWMQTT_INFLIGHT_FREE;
+        *packet_type = LWMQTT_NO_PACKET;
+
+        // call callback if set
+        if (client->inflight_callback != NULL) {
+          client->inflight_callback(client, client->inflight_callback_ref, packet_id);
+        }
+      }
+
+      break;
+    }
+
     // handle pingresp packets
     case LWMQTT_PINGRESP_PACKET: {
       // set flag
@@ -363,8 +561,9 @@ lwmqtt_err_t lwmqtt_connect(lwmqtt_client_t *client, lwmqtt_options_t options, l
   // set keep alive timer
   client->timer_set(client->keep_alive_timer, client->keep_alive_interval);
 
-  // reset pong pending flag
+  // reset pong pending and session present flag
   client->pong_pending = false;
+  client->session_present = false;
 
   // encode connect packet
   size_t len;
@@ -389,8 +588,7 @@ lwmqtt_err_t lwmqtt_connect(lwmqtt_client_t *client, lwmqtt_options_t options, l
   }
 
   // decode connack packet
-  bool session_present;
-  err = lwmqtt_decode_connack(client->read_buf, client->read_buf_size, &session_present, return_code);
+  err = lwmqtt_decode_connack(client->read_buf, client->read_buf_size, &client->session_present, return_code);
   if (err != LWMQTT_SUCCESS) {
     return err;
   }
@@ -403,6 +601,8 @@ lwmqtt_err_t lwmqtt_connect(lwmqtt_client_t *client, lwmqtt_options_t options, l
   return LWMQTT_SUCCESS;
 }
 
+bool lwmqtt_session_present(lwmqtt_client_t *client) { return client->session_present; }
+
 lwmqtt_err_t lwmqtt_subscribe(lwmqtt_client_t *client, int count, lwmqtt_string_t *topic_filter, lwmqtt_qos_t *qos,
                               uint32_t timeout) {
   // set command timer
@@ -497,6 +697,40 @@ lwmqtt_err_t lwmqtt_unsubscribe_one(lwmqtt_client_t *client, lwmqtt_string_t top
   return lwmqtt_unsubscribe(client, 1, &topic_filter, timeout);
 }
 
+static lwmqtt_err_t lwmqtt_await_publish_acks(lwmqtt_client_t *client, lwmqtt_qos_t qos) {
+  // immediately return on qos zero
+  if (qos == LWMQTT_QOS0) {
+    return LWMQTT_SUCCESS;
+  }
+
+  // define ack packet
+  lwmqtt_packet_type_t ack_type = LWMQTT_NO_PACKET;
+  if (qos == LWMQTT_QOS1) {
+    ack_type = LWMQTT_PUBACK_PACKET;
+  } else if (qos == LWMQTT_QOS2) {
+    ack_type = LWMQTT_PUBCOMP_PACKET;
+  }
+
+  // wait for ack packet
+  lwmqtt_packet_type_t packet_type = LWMQTT_NO_PACKET;
+  lwmqtt_err_t err = lwmqtt_cycle_until(client, &packet_type, 0, ack_type);
+  if (err != LWMQTT_SUCCESS) {
+    return err;
+  } else if (packet_type != ack_type) {
+    return LWMQTT_MISSING_OR_WRONG_PACKET;
+  }
+
+  // decode ack packet
+  bool dup;
+  uint16_t packet_id;
+  err = lwmqtt_decode_ack(client->read_buf, client->read_buf_size, ack_type, &dup, &packet_id);
+  if (err != LWMQTT_SUCCESS) {
+    return err;
+  }
+
+  return LWMQTT_SUCCESS;
+}
+
 lwmqtt_err_t lwmqtt_publish(lwmqtt_client_t *client, lwmqtt_string_t topic, lwmqtt_message_t message,
                             uint32_t timeout) {
   // set command timer
@@ -522,35 +756,175 @@ lwmqtt_err_t lwmqtt_publish(lwmqtt_client_t *client, lwmqtt_string_t topic, lwmq
     return err;
   }
 
-  // immediately return on qos zero
-  if (message.qos == LWMQTT_QOS0) {
-    return LWMQTT_SUCCESS;
+  // wait for acks
+  return lwmqtt_await_publish_acks(client, message.qos);
+}
+
+lwmqtt_err_t lwmqtt_publish_prepared(lwmqtt_client_t *client, lwmqtt_publish_template_t *tpl, uint8_t *payload,
+                                     size_t payload_len, uint32_t timeout) {
+  // set command timer
+  client->timer_set(client->command_timer, timeout);
+
+  // add packet id if at least qos 1
+  uint16_t packet_id = 0;
+  if (tpl->qos == LWMQTT_QOS1 || tpl->qos == LWMQTT_QOS2) {
+    packet_id = lwmqtt_get_next_packet_id(client);
   }
 
-  // define ack packet
-  lwmqtt_packet_type_t ack_type = LWMQTT_NO_PACKET;
-  if (message.qos == LWMQTT_QOS1) {
-    ack_type = LWMQTT_PUBACK_PACKET;
-  } else if (message.qos == LWMQTT_QOS2) {
-    ack_type = LWMQTT_PUBCOMP_PACKET;
+  // complete packet in the template
+  uint8_t *packet;
+  size_t len = 0;
+  lwmqtt_err_t err = lwmqtt_encode_prepared_publish(tpl, packet_id, payload, payload_len, &packet, &len);
+  if (err != LWMQTT_SUCCESS) {
+    return err;
   }
 
-  // wait for ack packet
-  lwmqtt_packet_type_t packet_type = LWMQTT_NO_PACKET;
-  err = lwmqtt_cycle_until(client, &packet_type, 0, ack_type);
+  // send packet
+  err = lwmqtt_send_packet(client, packet, len);
   if (err != LWMQTT_SUCCESS) {
     return err;
-  } else if (packet_type != ack_type) {
-    return LWMQTT_MISSING_OR_WRONG_PACKET;
   }
 
-  // decode ack packet
-  bool dup;
-  err = lwmqtt_decode_ack(client->read_buf, client->read_buf_size, ack_type, &dup, &packet_id);
+  // wait for acks
+  return lwmqtt_await_publish_acks(client, tpl->qos);
+}
+
+lwmqtt_err_t lwmqtt_publish_async(lwmqtt_client_t *client, lwmqtt_string_t topic, lwmqtt_message_t message,
+                                  uint16_t *packet_id, uint32_t timeout) {
+  // set command timer
+  client->timer_set(client->command_timer, timeout);
+
+  // reserve in-flight entry if at least qos 1
+  lwmqtt_inflight_t *entry = NULL;
+  uint16_t id = 0;
+  if (message.qos == LWMQTT_QOS1 || message.qos == LWMQTT_QOS2) {
+    entry = lwmqtt_inflight_find(client, 0, LWMQTT_INFLIGHT_FREE);
+    if (entry == NULL) {
+      return LWMQTT_INFLIGHT_WINDOW_FULL;
+    }
+
+    id = lwmqtt_get_next_packet_id(client);
+  }
+
+  // encode publish packet
+  size_t len = 0;
+  lwmqtt_err_t err = lwmqtt_encode_publish(client->write_buf, client->write_buf_size, &len, 0, id, topic, message);
   if (err != LWMQTT_SUCCESS) {
     return err;
   }
 
+  // send packet
+  err = lwmqtt_send_packet_in_buffer(client, len);
+  if (err != LWMQTT_SUCCESS) {
+    return err;
+  }
+
+  // track message until acked
+  if (entry != NULL) {
+    entry->packet_id = id;
+    entry->state = message.qos == LWMQTT_QOS1 ? LWMQTT_INFLIGHT_AWAIT_PUBACK : LWMQTT_INFLIGHT_AWAIT_PUBREC;
+  }
+
+  // set packet id if requested
+  if (packet_id != NULL) {
+    *packet_id = id;
+  }
+
+  return LWMQTT_SUCCESS;
+}
+
+int lwmqtt_inflight_count(lwmqtt_client_t *client) {
+  // count used entries
+  int count = 0;
+  for (int i = 0; i < client->inflight_size; i++) {
+    if (client->inflight[i].state != LWMQTT_INFLIGHT_FREE) {
+      count++;
+    }
+  }
+
+  return count;
+}
+
+bool lwmqtt_inflight_pending(lwmqtt_client_t *client, uint16_t packet_id) {
+  // search used entry with matching id
+  for (int i = 0; i < client->inflight_size; i++) {
+    if (client->inflight[i].state != LWMQTT_INFLIGHT_FREE && client->inflight[i].packet_id == packet_id) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+lwmqtt_err_t lwmqtt_publish_batch(lwmqtt_client_t *client, int count, lwmqtt_string_t *topics,
+                                  lwmqtt_message_t *messages, uint32_t timeout) {
+  // set command timer
+  client->timer_set(client->command_timer, timeout);
+
+  // prepare offset
+  size_t offset = 0;
+
+  // encode all publish packets
+  for (int i = 0; i < count; i++) {
+    // add packet id if at least qos 1
+    uint16_t packet_id = 0;
+    if (messages[i].qos == LWMQTT_QOS1 || messages[i].qos == LWMQTT_QOS2) {
+      packet_id = lwmqtt_get_next_packet_id(client);
+    }
+
+    // encode publish packet after the previous ones
+    size_t len = 0;
+    lwmqtt_err_t err = lwmqtt_encode_publish(client->write_buf + offset, client->write_buf_size - offset, &len, 0,
+                                             packet_id, topics[i], messages[i]);
+
+    // write pending packets and retry at start of buffer if the buffer is full
+    if (err == LWMQTT_BUFFER_TOO_SHORT && offset > 0) {
+      err = lwmqtt_write_to_network(client, client->write_buf, offset);
+      if (err != LWMQTT_SUCCESS) {
+        return err;
+      }
+
+      offset = 0;
+      err = lwmqtt_encode_publish(client->write_buf, client->write_buf_size, &len, 0, packet_id, topics[i],
+                                  messages[i]);
+    }
+
+    if (err != LWMQTT_SUCCESS) {
+      return err;
+    }
+
+    // advance offset
+    offset += len;
+  }
+
+  // send remaining packets
+  lwmqtt_err_t err = lwmqtt_send_packet_in_buffer(client, offset);
+  if (err != LWMQTT_SUCCESS) {
+    return err;
+  }
+
+  // wait for acks in order of the messages
+  for (int i = 0; i < count; i++) {
+    // define ack packet
+    lwmqtt_packet_type_t ack_type = LWMQTT_NO_PACKET;
+    if (messages[i].qos == LWMQTT_QOS1) {
+      ack_type = LWMQTT_PUBACK_PACKET;
+    } else if (messages[i].qos == LWMQTT_QOS2) {
+      ack_type = LWMQTT_PUBCOMP_PACKET;
+    } else {
+      continue;
+    }
+
+    // wait for ack packet
+    lwmqtt_packet_type_t packet_type = LWMQTT_NO_PACKET;
+    err = lwmqtt_cycle_until(client, &packet_type, 0, ack_type);
+    if (err != LWMQTT_SUCCESS) {
+      return err;
+    } else if (packet_type != ack_type) {
+      return LWMQTT_MISSING_OR_WRONG_PACKET;
+    }
+  }
+
   return LWMQTT_SUCCESS;
 }
 
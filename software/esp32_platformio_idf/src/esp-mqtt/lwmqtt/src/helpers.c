@@ -2,10 +2,11 @@
 
 #include "helpers.h"
 
-uint8_t lwmqtt_read_bits(uint8_t byte, int pos, int num) { return (byte & (uint8_t)((~(0xFF << num)) << pos)) >> pos; }
+// the masks are computed unsigned, shifting the negative result of ~ is undefined behaviour
+uint8_t lwmqtt_read_bits(uint8_t byte, int pos, int num) { return (byte & (uint8_t)((~(0xFFu << num)) << pos)) >> pos; }
 
 void lwmqtt_write_bits(uint8_t *byte, uint8_t value, int pos, int num) {
-  *byte = (*byte & ~(uint8_t)((~(0xFF << num)) << pos)) | (value << pos);
+  *byte = (uint8_t)((*byte & ~((~(0xFFu << num)) << pos)) | ((unsigned)value << pos));
 }
 
 lwmqtt_err_t lwmqtt_read_data(uint8_t **buf, const uint8_t *buf_end, uint8_t **data, size_t len) {
@@ -155,10 +156,10 @@ lwmqtt_err_t lwmqtt_varnum_length(uint32_t varnum, int *len) {
   } else if (varnum < 16384) {
     *len = 2;
     return LWMQTT_SUCCESS;
-  } else if (varnum < 2097151) {
+  } else if (varnum < 2097152) {
     *len = 3;
     return LWMQTT_SUCCESS;
-  } else if (varnum < 268435455) {
+  } else if (varnum < 268435456) {
     *len = 4;
     return LWMQTT_SUCCESS;
   } else {
@@ -167,80 +168,70 @@ lwmqtt_err_t lwmqtt_varnum_length(uint32_t varnum, int *len) {
   }
 }
 
-lwmqtt_err_t lwmqtt_read_varnum(uint8_t **buf, const uint8_t *buf_end, uint32_t *varnum) {
-  // prepare last byte
-  uint8_t byte;
+lwmqtt_err_t lwmqtt_varnum_decoder_feed(lwmqtt_varnum_decoder_t *decoder, uint8_t byte) {
+  // add the seven value bits at their position
+  decoder->varnum |= (uint32_t)(byte & 127) << (7 * decoder->len);
+  decoder->len++;
 
-  // prepare multiplier
-  uint32_t multiplier = 1;
+  // check if this has been the last byte
+  if ((byte & 128) == 0) {
+    return LWMQTT_SUCCESS;
+  }
 
-  // prepare length
-  size_t len = 0;
+  // a number has at most four bytes
+  return decoder->len == 4 ? LWMQTT_VARNUM_OVERFLOW : LWMQTT_BUFFER_TOO_SHORT;
+}
 
-  // initialize number
-  *varnum = 0;
+lwmqtt_err_t lwmqtt_read_varnum(uint8_t **buf, const uint8_t *buf_end, uint32_t *varnum) {
+  // prepare pointer
+  const uint8_t *ptr = *buf;
 
   // decode variadic number
-  do {
-    // increment length
-    len++;
-
+  uint32_t value = 0;
+  for (int shift = 0; shift < 28; shift += 7) {
     // return error if buffer is to small
-    if ((size_t)(buf_end - (*buf)) < len) {
+    if (ptr == buf_end) {
+      *varnum = 0;
       return LWMQTT_BUFFER_TOO_SHORT;
     }
 
-    // return error if the length has overflowed
-    if (len > 4) {
-      return LWMQTT_VARNUM_OVERFLOW;
-    }
+    // add the seven value bits at their position
+    uint8_t byte = *ptr++;
+    value |= (uint32_t)(byte & 127) << shift;
 
-    // read byte
-    byte = (*buf)[len - 1];
-
-    // add byte to number
-    *varnum += (byte & 127) * multiplier;
-
-    // increase multiplier
-    multiplier *= 128;
-  } while ((byte & 128) != 0);
-
-  // adjust pointer
-  *buf += len;
+    // return number if this has been the last byte
+    if ((byte & 128) == 0) {
+      *varnum = value;
+      *buf = (uint8_t *)ptr;
+      return LWMQTT_SUCCESS;
+    }
+  }
 
-  return LWMQTT_SUCCESS;
+  // return error as the length has overflowed
+  *varnum = 0;
+  return LWMQTT_VARNUM_OVERFLOW;
 }
 
 lwmqtt_err_t lwmqtt_write_varnum(uint8_t **buf, const uint8_t *buf_end, uint32_t varnum) {
-  // init len counter
-  size_t len = 0;
-
-  // encode variadic number
-  do {
-    // check overflow
-    if (len == 4) {
-      return LWMQTT_VARNUM_OVERFLOW;
-    }
-
-    // return error if buffer is to small
-    if ((size_t)(buf_end - (*buf)) < len + 1) {
-      return LWMQTT_BUFFER_TOO_SHORT;
-    }
-
-    // calculate current byte
-    uint8_t byte = (uint8_t)(varnum % 128);
+  // get length in one step
+  int len;
+  lwmqtt_err_t err = lwmqtt_varnum_length(varnum, &len);
+  if (err != LWMQTT_SUCCESS) {
+    return err;
+  }
 
-    // change remaining length
-    varnum /= 128;
+  // return error if buffer is to small
+  if ((size_t)(buf_end - (*buf)) < (size_t)len) {
+    return LWMQTT_BUFFER_TOO_SHORT;
+  }
 
-    // set the top bit of this byte if there are more to encode
-    if (varnum > 0) {
-      byte |= 0x80;
-    }
+  // write all bytes but the last with the continuation bit set
+  for (int i = 0; i < len - 1; i++) {
+    (*buf)[i] = (uint8_t)(varnum >> (7 * i)) | 0x80;
+  }
 
-    // write byte
-    (*buf)[len++] = byte;
-  } while (varnum > 0);
+  // write last byte
+  (*buf)[len - 1] = (uint8_t)(varnum >> (7 * (len - 1)));
 
   // adjust pointer
   *buf += len;
@@ -114,6 +114,30 @@ lwmqtt_err_t lwmqtt_write_byte(uint8_t **buf, const uint8_t *buf_end, uint8_t by
  */
 lwmqtt_err_t lwmqtt_varnum_length(uint32_t varnum, int *len);
 
+/**
+ * The state of an incremental variable number decoder.
+ */
+typedef struct {
+  uint32_t varnum;
+  int len;
+} lwmqtt_varnum_decoder_t;
+
+/**
+ * The initializer for variable number decoders.
+ */
+#define lwmqtt_default_varnum_decoder \
+  { 0, 0 }
+
+/**
+ * Adds the next byte of a variable number to the decoder. Allows to decode a number while its bytes are received.
+ *
+ * @param decoder - The decoder.
+ * @param byte - The next byte.
+ * @return LWMQTT_SUCCESS if the number is complete, LWMQTT_BUFFER_TOO_SHORT if more bytes are needed or
+ * LWMQTT_VARNUM_OVERFLOW.
+ */
+lwmqtt_err_t lwmqtt_varnum_decoder_feed(lwmqtt_varnum_decoder_t *decoder, uint8_t byte);
+
 /**
  * Reads a variable number from the specified buffer. The pointer is incremented by the bytes read.
  *
@@ -0,0 +1,214 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../../include/lwmqtt/unix.h"
+
+void lwmqtt_unix_timer_set(void *ref, uint32_t timeout) {
+  // cast timer reference
+  lwmqtt_unix_timer_t *t = (lwmqtt_unix_timer_t *)ref;
+
+  // clear end time
+  timerclear(&t->end);
+
+  // get current time
+  struct timeval now;
+  gettimeofday(&now, NULL);
+
+  // set future end time
+  struct timeval interval = {timeout / 1000, (timeout % 1000) * 1000};
+  timeradd(&now, &interval, &t->end);
+}
+
+int32_t lwmqtt_unix_timer_get(void *ref) {
+  // cast timer reference
+  lwmqtt_unix_timer_t *t = (lwmqtt_unix_timer_t *)ref;
+
+  // get current time
+  struct timeval now;
+  gettimeofday(&now, NULL);
+
+  // get difference to end time
+  struct timeval res;
+  timersub(&t->end, &now, &res);
+
+  return (int32_t)(res.tv_sec * 1000 + res.tv_usec / 1000);
+}
+
+lwmqtt_err_t lwmqtt_unix_network_connect(lwmqtt_unix_network_t *network, char *host, int port) {
+  // close any open socket
+  lwmqtt_unix_network_disconnect(network);
+
+  // prepare hints
+  struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_STREAM};
+
+  // lookup ip address
+  struct addrinfo *res;
+  int r = getaddrinfo(host, NULL, &hints, &res);
+  if (r != 0 || res == NULL) {
+    return LWMQTT_NETWORK_FAILED_CONNECT;
+  }
+
+  // copy address and set port
+  struct sockaddr_in addr;
+  memcpy(&addr, res->ai_addr, sizeof(addr));
+  addr.sin_port = htons((uint16_t)port);
+
+  // free address
+  freeaddrinfo(res);
+
+  // create socket
+  int s = socket(AF_INET, SOCK_STREAM, 0);
+  if (s < 0) {
+    return LWMQTT_NETWORK_FAILED_CONNECT;
+  }
+
+  // connect socket
+  r = connect(s, (struct sockaddr *)&addr, sizeof(addr));
+  if (r < 0) {
+    close(s);
+    return LWMQTT_NETWORK_FAILED_CONNECT;
+  }
+
+  // disable nagle's algorithm
+  int flag = 1;
+  r = setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(int));
+  if (r < 0) {
+    close(s);
+    return LWMQTT_NETWORK_FAILED_CONNECT;
+  }
+
+  return lwmqtt_unix_network_open(network, s);
+}
+
+lwmqtt_err_t lwmqtt_unix_network_open(lwmqtt_unix_network_t *network, int socket) {
+  // make socket non-blocking, timeouts are handled by poll
+  int flags = fcntl(socket, F_GETFL, 0);
+  if (flags < 0 || fcntl(socket, F_SETFL, flags | O_NONBLOCK) < 0) {
+    return LWMQTT_NETWORK_FAILED_CONNECT;
+  }
+
+  // set socket and reset counters
+  network->socket = socket;
+  memset(&network->counters, 0, sizeof(network->counters));
+
+  return LWMQTT_SUCCESS;
+}
+
+void lwmqtt_unix_network_disconnect(lwmqtt_unix_network_t *network) {
+  // close socket if present
+  if (network->socket) {
+    close(network->socket);
+    network->socket = 0;
+  }
+}
+
+static int lwmqtt_unix_network_wait(lwmqtt_unix_network_t *network, bool write, uint32_t timeout) {
+  // wait until socket is ready
+  network->counters.polls++;
+  struct pollfd fd = {.fd = network->socket, .events = write ? POLLOUT : POLLIN};
+  return poll(&fd, 1, (int)timeout);
+}
+
+lwmqtt_err_t lwmqtt_unix_network_peek(lwmqtt_unix_network_t *network, size_t *available) {
+  // get the available bytes on the socket
+  int bytes = 0;
+  int rc = ioctl(network->socket, FIONREAD, &bytes);
+  if (rc < 0) {
+    return LWMQTT_NETWORK_FAILED_READ;
+  }
+
+  // set available bytes
+  *available = (size_t)bytes;
+
+  return LWMQTT_SUCCESS;
+}
+
+lwmqtt_err_t lwmqtt_unix_network_select(lwmqtt_unix_network_t *network, bool *available, uint32_t timeout) {
+  // wait for data
+  int result = lwmqtt_unix_network_wait(network, false, timeout);
+  if (result < 0) {
+    return LWMQTT_NETWORK_FAILED_READ;
+  }
+
+  // set whether data is available
+  *available = result > 0;
+
+  return LWMQTT_SUCCESS;
+}
+
+lwmqtt_err_t lwmqtt_unix_network_read(void *ref, uint8_t *buffer, size_t len, size_t *read, uint32_t timeout) {
+  // cast network reference
+  lwmqtt_unix_network_t *n = (lwmqtt_unix_network_t *)ref;
+
+  // read from socket
+  n->counters.reads++;
+  ssize_t bytes = recv(n->socket, buffer, len, 0);
+
+  // wait for data once if none is available
+  if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    int result = lwmqtt_unix_network_wait(n, false, timeout);
+    if (result < 0) {
+      return LWMQTT_NETWORK_FAILED_READ;
+    } else if (result == 0) {
+      // the caller checks its timer
+      return LWMQTT_SUCCESS;
+    }
+
+    // read again
+    n->counters.reads++;
+    bytes = recv(n->socket, buffer, len, 0);
+  }
+
+  // a closed connection reads zero bytes
+  if (bytes <= 0) {
+    return LWMQTT_NETWORK_FAILED_READ;
+  }
+
+  // increment counters
+  n->counters.bytes_read += (size_t)bytes;
+  *read += (size_t)bytes;
+
+  return LWMQTT_SUCCESS;
+}
+
+lwmqtt_err_t lwmqtt_unix_network_write(void *ref, uint8_t *buffer, size_t len, size_t *sent, uint32_t timeout) {
+  // cast network reference
+  lwmqtt_unix_network_t *n = (lwmqtt_unix_network_t *)ref;
+
+  // write to socket
+  n->counters.writes++;
+  ssize_t bytes = send(n->socket, buffer, len, MSG_NOSIGNAL);
+
+  // wait for space once if the send buffer is full
+  if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    int result = lwmqtt_unix_network_wait(n, true, timeout);
+    if (result < 0) {
+      return LWMQTT_NETWORK_FAILED_WRITE;
+    } else if (result == 0) {
+      // the caller checks its timer
+      return LWMQTT_SUCCESS;
+    }
+
+    // write again
+    n->counters.writes++;
+    bytes = send(n->socket, buffer, len, MSG_NOSIGNAL);
+  }
+
+  if (bytes < 0) {
+    return LWMQTT_NETWORK_FAILED_WRITE;
+  }
+
+  // increment counters
+  n->counters.bytes_written += (size_t)bytes;
+  *sent += (size_t)bytes;
+
+  return LWMQTT_SUCCESS;
+}
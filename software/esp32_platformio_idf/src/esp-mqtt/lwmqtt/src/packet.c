@@ -544,6 +544,93 @@ lwmqtt_err_t lwmqtt_encode_publish(uint8_t *buf, size_t buf_len, size_t *len, bo
   return LWMQTT_SUCCESS;
 }
 
+lwmqtt_err_t lwmqtt_prepare_publish(lwmqtt_publish_template_t *tpl, uint8_t *buf, size_t buf_size,
+                                    lwmqtt_string_t topic, lwmqtt_qos_t qos, bool retained) {
+  // check room for the fixed header
+  if (buf_size < LWMQTT_PUBLISH_TEMPLATE_HEADER) {
+    return LWMQTT_BUFFER_TOO_SHORT;
+  }
+
+  // write topic behind the fixed header
+  uint8_t *buf_ptr = buf + LWMQTT_PUBLISH_TEMPLATE_HEADER;
+  lwmqtt_err_t err = lwmqtt_write_string(&buf_ptr, buf + buf_size, topic);
+  if (err != LWMQTT_SUCCESS) {
+    return err;
+  }
+
+  // prepare header
+  uint8_t header = 0;
+
+  // set packet type
+  lwmqtt_write_bits(&header, LWMQTT_PUBLISH_PACKET, 4, 4);
+
+  // set qos
+  lwmqtt_write_bits(&header, qos, 1, 2);
+
+  // set retained
+  lwmqtt_write_bits(&header, (uint8_t)(retained), 0, 1);
+
+  // set template
+  tpl->buf = buf;
+  tpl->buf_size = buf_size;
+  tpl->topic_len = (size_t)(buf_ptr - buf) - LWMQTT_PUBLISH_TEMPLATE_HEADER;
+  tpl->header = header;
+  tpl->qos = qos;
+
+  return LWMQTT_SUCCESS;
+}
+
+lwmqtt_err_t lwmqtt_encode_prepared_publish(lwmqtt_publish_template_t *tpl, uint16_t packet_id, uint8_t *payload,
+                                            size_t payload_len, uint8_t **packet, size_t *len) {
+  // prepare pointer behind the topic
+  uint8_t *variable = tpl->buf + LWMQTT_PUBLISH_TEMPLATE_HEADER;
+  uint8_t *buf_ptr = variable + tpl->topic_len;
+  uint8_t *buf_end = tpl->buf + tpl->buf_size;
+
+  // write packet id if qos is at least 1
+  if (tpl->qos > 0) {
+    lwmqtt_err_t err = lwmqtt_write_num(&buf_ptr, buf_end, packet_id);
+    if (err != LWMQTT_SUCCESS) {
+      return err;
+    }
+  }
+
+  // write payload
+  lwmqtt_err_t err = lwmqtt_write_data(&buf_ptr, buf_end, payload, payload_len);
+  if (err != LWMQTT_SUCCESS) {
+    return err;
+  }
+
+  // get remaining length
+  uint32_t rem_len = (uint32_t)(buf_ptr - variable);
+
+  // write remaining length in front of the topic, a single byte for small packets
+  uint8_t *start;
+  if (rem_len < 128) {
+    start = variable - 2;
+    start[1] = (uint8_t)rem_len;
+  } else {
+    int rem_len_len;
+    err = lwmqtt_varnum_length(rem_len, &rem_len_len);
+    if (err == LWMQTT_VARNUM_OVERFLOW) {
+      return LWMQTT_REMAINING_LENGTH_OVERFLOW;
+    }
+
+    start = variable - 1 - rem_len_len;
+    uint8_t *rem_len_ptr = start + 1;
+    lwmqtt_write_varnum(&rem_len_ptr, variable, rem_len);
+  }
+
+  // write header
+  start[0] = tpl->header;
+
+  // set packet
+  *packet = start;
+  *len = (size_t)(buf_ptr - start);
+
+  return LWMQTT_SUCCESS;
+}
+
 lwmqtt_err_t lwmqtt_encode_subscribe(uint8_t *buf, size_t buf_len, size_t *len, uint16_t packet_id, int count,
                                      lwmqtt_string_t *topic_filters, lwmqtt_qos_t *qos_levels) {
   // prepare pointer
@@ -650,7 +737,7 @@ lwmqtt_err_t lwmqtt_decode_suback(uint8_t *buf, size_t buf_len, uint16_t *packet
   // read all suback codes
   for (*count = 0; *count < (int)rem_len - 2; (*count)++) {
     // check max count
-    if (*count > max_count) {
+    if (*count >= max_count) {
       return LWMQTT_SUBACK_ARRAY_OVERFLOW;
     }
 
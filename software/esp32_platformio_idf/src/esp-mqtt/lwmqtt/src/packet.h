@@ -139,6 +139,20 @@ lwmqtt_err_t lwmqtt_decode_publish(uint8_t *buf, size_t buf_len, bool *dup, uint
 lwmqtt_err_t lwmqtt_encode_publish(uint8_t *buf, size_t buf_len, size_t *len, bool dup, uint16_t packet_id,
                                    lwmqtt_string_t topic, lwmqtt_message_t msg);
 
+/**
+ * Completes the publish packet of a template by adding the payload, the packet id and the remaining length.
+ *
+ * @param tpl - The template object.
+ * @param packet_id - The packet id, ignored for QOS 0.
+ * @param payload - The payload.
+ * @param payload_len - The length of the payload.
+ * @param packet - The variable that will receive the start of the packet in the buffer of the template.
+ * @param len - The encoded length of the packet.
+ * @return An error value.
+ */
+lwmqtt_err_t lwmqtt_encode_prepared_publish(lwmqtt_publish_template_t *tpl, uint16_t packet_id, uint8_t *payload,
+                                            size_t payload_len, uint8_t **packet, size_t *len);
+
 /**
  * Encodes a subscribe packet into the supplied buffer.
  *
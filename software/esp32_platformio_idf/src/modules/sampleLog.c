@@ -0,0 +1,85 @@
+#include "sampleLog.h"
+#include <stdint.h>
+#include <sys/time.h>
+#include "esp_attr.h"
+#include "esp_log.h"
+
+_Static_assert( sizeof(sampleLog_entry_t) == 6, "sample entry must be packed" );
+_Static_assert( SAMPLE_LOG_SIZE * sizeof(sampleLog_entry_t) <= 6 * 1024, "sample log exceeds its rtc ram budget" );
+
+//Keep samples in rtc ram, this memory will not be cleared by deep-sleep
+static RTC_DATA_ATTR sampleLog_entry_t _entries[SAMPLE_LOG_SIZE];
+static RTC_DATA_ATTR uint16_t _head; //Index of the oldest sample
+static RTC_DATA_ATTR uint16_t _count;
+static RTC_DATA_ATTR time_t _lastTime; //Time of the newest sample
+
+//Seconds since boot, keeps counting during deep-sleep
+static time_t sampleLog_now() {
+    struct timeval tv;
+    gettimeofday( &tv, NULL );
+    return tv.tv_sec;
+}
+
+void sampleLog_add(float temperature, float humidity, uint8_t valve) {
+
+    time_t now = sampleLog_now();
+    time_t delta = _count > 0 ? now - _lastTime : 0;
+
+    //Overwrite oldest sample if ring is full
+    if( _count == SAMPLE_LOG_SIZE ) {
+        _head = (_head + 1) % SAMPLE_LOG_SIZE;
+        _count--;
+    }
+
+    sampleLog_entry_t* entry = &_entries[(_head + _count) % SAMPLE_LOG_SIZE];
+
+    entry->delta = delta > UINT16_MAX ? UINT16_MAX : (uint16_t) delta;
+    entry->temperature = (int16_t) (temperature * 100);
+    entry->humidity = humidity < 0 ? 0 : humidity > 100 ? 100 : (uint8_t) humidity;
+    entry->valve = valve;
+
+    _count++;
+    _lastTime = now;
+
+    ESP_LOGD( "SAMPLE", "Sample %u: %d/100 °C, %u %%RH, %u %%", _count, entry->temperature, entry->humidity, entry->valve );
+}
+
+uint16_t sampleLog_count() {
+    return _count;
+}
+
+uint32_t sampleLog_age(uint16_t offset) {
+
+    if( offset >= _count )
+        return 0;
+
+    //Age of newest sample plus the deltas of all samples after the one at offset
+    uint32_t age = sampleLog_now() - _lastTime;
+
+    for( uint16_t i = offset + 1; i < _count; i++ )
+        age += _entries[(_head + i) % SAMPLE_LOG_SIZE].delta;
+
+    return age;
+}
+
+uint16_t sampleLog_peek(uint16_t offset, sampleLog_entry_t* dst, uint16_t max) {
+
+    if( offset >= _count )
+        return 0;
+
+    uint16_t count = _count - offset < max ? _count - offset : max;
+
+    for( uint16_t i = 0; i < count; i++ )
+        dst[i] = _entries[(_head + offset + i) % SAMPLE_LOG_SIZE];
+
+    return count;
+}
+
+void sampleLog_drop(uint16_t count) {
+
+    if( count > _count )
+        count = _count;
+
+    _head = (_head + count) % SAMPLE_LOG_SIZE;
+    _count -= count;
+}
@@ -0,0 +1,40 @@
+#ifndef SAMPLELOG_H
+#define SAMPLELOG_H
+
+#include <stdint.h>
+
+//Ring capacity: 1024 entries * 6 bytes = 6 KiB of the 8 KiB slow RTC RAM. The rest is left for the other RTC variables
+#define SAMPLE_LOG_SIZE 1024
+
+//Fixed-point sample, packed to 6 bytes
+typedef struct __attribute__((packed)) {
+    uint16_t delta;       //Seconds since previous sample
+    int16_t temperature;  //Temperature in 1/100 °C
+    uint8_t humidity;     //Relative humidity in %
+    uint8_t valve;        //Valve position in %
+} sampleLog_entry_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//Add a sample. Overwrites the oldest sample if the ring is full
+void sampleLog_add(float temperature, float humidity, uint8_t valve);
+
+//Get count of stored samples
+uint16_t sampleLog_count();
+
+//Get age in seconds of the sample at offset, counted from the oldest sample
+uint32_t sampleLog_age(uint16_t offset);
+
+//Copy up to max samples starting at offset from the oldest sample to dst, returns the count of copied samples
+uint16_t sampleLog_peek(uint16_t offset, sampleLog_entry_t* dst, uint16_t max);
+
+//Remove the count oldest samples, e.g. after they are uploaded
+void sampleLog_drop(uint16_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SAMPLELOG_H
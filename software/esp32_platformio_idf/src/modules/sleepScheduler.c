@@ -0,0 +1,150 @@
+#include "sleepScheduler.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include <sys/time.h>
+#include "esp_sleep.h"
+#include "driver/gpio.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "board/board.h"
+#include "board/config.h"
+
+static const char *TAG = "SLEEP";
+
+//Keep limits and last measurement in rtc ram, this memory will not be cleared by deep-sleep
+static RTC_DATA_ATTR uint32_t _minPeriod = SLEEP_MIN_PERIOD;
+static RTC_DATA_ATTR uint32_t _maxPeriod = SLEEP_MAX_PERIOD;
+static RTC_DATA_ATTR float _lastTemperature;
+static RTC_DATA_ATTR time_t _lastTime;
+
+//Inputs of the current wake cycle
+static float _temperature = NAN;
+static float _targetTemp = NAN;
+static bool _settling = false;
+static bool _buttonWake = false;
+
+//Seconds since boot, keeps counting during deep-sleep
+static time_t sleepScheduler_now() {
+    struct timeval tv;
+    gettimeofday( &tv, NULL );
+    return tv.tv_sec;
+}
+
+void sleepScheduler_init() {
+
+    esp_sleep_wakeup_cause_t cause = esp_sleep_get_wakeup_cause();
+
+    //Only BUTTON_1 wakes up by ext0. Ext1 can wake up on all pins low only but not on any, so the other buttons are
+    //polled on every wake up and count if they are held at that moment
+    _buttonWake = cause == ESP_SLEEP_WAKEUP_EXT0 ||
+                  gpio_get_level( (gpio_num_t) BUTTON_2 ) == BUTTON_WAKEUP_LEVEL ||
+                  gpio_get_level( (gpio_num_t) BUTTON_3 ) == BUTTON_WAKEUP_LEVEL;
+
+    ESP_LOGD( TAG, "Wake up cause: %d", cause );
+}
+
+bool sleepScheduler_isButtonWake() {
+    return _buttonWake;
+}
+
+void sleepScheduler_setTemperature(float temperature, float targetTemp) {
+    _temperature = temperature;
+    _targetTemp = targetTemp;
+}
+
+void sleepScheduler_setValveSettling(bool settling) {
+    _settling = settling;
+}
+
+void sleepScheduler_setLimits(uint32_t minPeriod, uint32_t maxPeriod) {
+
+    //Ignore invalid limits
+    if( minPeriod == 0 || minPeriod > maxPeriod ) {
+        ESP_LOGW( TAG, "Invalid limits %u/%u s", minPeriod, maxPeriod );
+        return;
+    }
+
+    _minPeriod = minPeriod;
+    _maxPeriod = maxPeriod;
+}
+
+uint32_t sleepScheduler_next(sleepScheduler_reason_t* reason) {
+
+    uint32_t period = _maxPeriod;
+    *reason = SLEEP_REASON_IDLE;
+
+    time_t now = sleepScheduler_now();
+
+    if( !isnan(_temperature) ) {
+
+        //Temperature trend in °C per second since last measurement
+        if( _lastTime != 0 && now > _lastTime ) {
+            float trend = fabsf( _temperature - _lastTemperature ) / (now - _lastTime);
+
+            //Wake up when the next change is measurable
+            if( trend > 0 && SLEEP_TEMP_RESOLUTION / trend < period ) {
+                period = SLEEP_TEMP_RESOLUTION / trend;
+                *reason = SLEEP_REASON_TREND;
+            }
+        }
+
+        //Watch closely around target temperature to avoid overshoot
+        if( !isnan(_targetTemp) && fabsf( _targetTemp - _temperature ) < SLEEP_TARGET_BAND && (_minPeriod + _maxPeriod) / 2 < period ) {
+            period = (_minPeriod + _maxPeriod) / 2;
+            *reason = SLEEP_REASON_TARGET;
+        }
+
+        _lastTemperature = _temperature;
+        _lastTime = now;
+    }
+
+    //Observe valve movement or user interaction with min. period
+    if( _buttonWake ) {
+        period = _minPeriod;
+        *reason = SLEEP_REASON_BUTTON;
+    } else if( _settling ) {
+        period = _minPeriod;
+        *reason = SLEEP_REASON_SETTLING;
+    }
+
+    //Keep period within limits
+    if( period < _minPeriod )
+        period = _minPeriod;
+    if( period > _maxPeriod )
+        period = _maxPeriod;
+
+    ESP_LOGI( TAG, "Next wake up in %u s (%s)", period, sleepScheduler_reasonName(*reason) );
+
+    return period;
+}
+
+const char* sleepScheduler_reasonName(sleepScheduler_reason_t reason) {
+
+    switch( reason ) {
+        case SLEEP_REASON_TREND:
+            return "trend";
+        case SLEEP_REASON_TARGET:
+            return "target";
+        case SLEEP_REASON_SETTLING:
+            return "settling";
+        case SLEEP_REASON_BUTTON:
+            return "button";
+        default:
+            return "idle";
+    }
+}
+
+void sleepScheduler_sleep(uint32_t period) {
+
+    //Wake up on a press of BUTTON_1. The other buttons do not wake up, they are polled after the timer wake up
+    esp_sleep_enable_ext0_wakeup( (gpio_num_t) BUTTON_1, BUTTON_WAKEUP_LEVEL );
+
+    //keep RTC RAM powered during deep sleep
+    esp_sleep_pd_config( ESP_PD_DOMAIN_RTC_SLOW_MEM, ESP_PD_OPTION_ON );
+
+    ESP_LOGD( TAG, "Enter deep sleep");
+
+    //Deep sleep (period * 10^6 µs)
+    esp_deep_sleep( (uint64_t) period * 1000000ULL );
+}
@@ -0,0 +1,48 @@
+#ifndef SLEEPSCHEDULER_H
+#define SLEEPSCHEDULER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//Reason for the chosen sleep period
+typedef enum {
+    SLEEP_REASON_IDLE = 0,  //Nothing changes -> Max. period
+    SLEEP_REASON_TREND,     //Temperature is moving -> Wake up when the next change is measurable
+    SLEEP_REASON_TARGET,    //Temperature is close to target -> Watch closely to avoid overshoot
+    SLEEP_REASON_SETTLING,  //Valve was moved -> Observe the response with min. period
+    SLEEP_REASON_BUTTON     //Woken up by user button -> Expect further interaction
+} sleepScheduler_reason_t;
+
+//Init scheduler and evaluate the wake up cause, the board must be initialised for the button pins
+void sleepScheduler_init();
+
+//True if woken up by BUTTON_1 or another button is held at wake up
+bool sleepScheduler_isButtonWake();
+
+//Set measured and target temperature of the current cycle
+void sleepScheduler_setTemperature(float temperature, float targetTemp);
+
+//Set if the valve was moved and the temperature has to settle
+void sleepScheduler_setValveSettling(bool settling);
+
+//Set min. and max. sleep period in seconds. The limits are kept during deep-sleep
+void sleepScheduler_setLimits(uint32_t minPeriod, uint32_t maxPeriod);
+
+//Calculate the next sleep period in seconds
+uint32_t sleepScheduler_next(sleepScheduler_reason_t* reason);
+
+//Get name of a reason for logging and publishing
+const char* sleepScheduler_reasonName(sleepScheduler_reason_t reason);
+
+//Arm button wake up and enter deep sleep for the given period in seconds
+void sleepScheduler_sleep(uint32_t period);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //SLEEPSCHEDULER_H
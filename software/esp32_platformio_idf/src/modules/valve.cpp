@@ -1,311 +1,459 @@
 #include "valve.h"
 #include <stdint.h>
 #include <stdlib.h>
-#include "freertos/FreeRTOS.h"
-#include "freertos/semphr.h"
-#include "freertos/portmacro.h"
-#include "freertos/task.h"
-#include "periph_ctrl.h"
-#include "pcnt.h" //Pulse counter
 #include "esp_attr.h"
 #include "esp_log.h"
-#include "board/board.h"
-#include "driver/drv883x.h"
+#include "board/config.h"
+#include "valveHal.h"
 
 #define OPEN 1
 #define CLOSE 0
 
 //Keep maxcounts and current valve position in rtc ram, this memory will not be cleared by deep-sleep
-static RTC_DATA_ATTR uint8_t _valvePosition;
+static RTC_DATA_ATTR int32_t _position; //Counts from the closed endstop
 static RTC_DATA_ATTR uint32_t _maxCounts;
 
-static const pcnt_unit_t pcnt_unit = PCNT_UNIT_0;
-static DRV883X motor( MOTOR_ENABLE, MOTOR_PHASE, MOTOR_nSLEEP );
-static SemaphoreHandle_t valveLock = NULL;
+//Drift model in rtc ram as well: the position error grows with the counts moved and is cleared at an endstop
+static RTC_DATA_ATTR uint32_t _travelSinceSync; //Counts moved since the position was synced at an endstop
+static RTC_DATA_ATTR uint16_t _driftRate = VALVE_DRIFT_RATE; //Position error in counts per 1000 counts moved
+static RTC_DATA_ATTR uint16_t _strokeMoves; //Moves since the stroke was measured
 
-//StallGuard can obtain motor movement
+//Mutex of the valve regulation
+static valveHal_lock_t valveLock = NULL;
+
+//Given once per movement by the target isr or the stall guard, whichever stops the motor first
+static valveHal_lock_t valveDone = NULL;
+
+//Motor is driven. The target isr and the stall guard claim the stop by an atomic exchange, so only one of them stops the
+//motor and gives valveDone
+static volatile uint32_t _moving = 0;
+
+//Speed profile of the current movement, ramp down to VALVE_SPEED_MIN towards the target counts (0 = full speed)
+static valveHal_timer_t controlTimer = NULL;
+static int16_t _rampCounts;
+static uint8_t _speed;
+
+//Stop motor and counting after the target position or a stall, task context only
+static void valve_halt() {
+
+    _moving = 0;
+
+    //Stop motor move, the pwm is switched off as well
+    valveHal_motorStop();
+    valveHal_motorSpeed( 0 );
+
+    //Disable reflex source
+    valveHal_reflexEnable( false );
+
+    //Stop counters and disable target
+    valveHal_counterStop();
+}
+
+//StallGuard detects a blocked motor. The milestone counter counts the reflex pulses too and wraps every VALVE_STALL_PULSES pulses.
+//Each wrap is a milestone, the guard stops the motor if no milestone is reached within VALVE_STALL_WINDOW_MS
 class StallGuard {
 
     private:
-        pcnt_unit_t _pcnt_unit;
-        int16_t _lastCount;
+        valveHal_timer_t _timer;
+        volatile int64_t _lastMilestone;
+        volatile bool _stalled;
 
-    public:
-        //Parameter: pcnt_unit whichs counter should be checked
-        StallGuard( pcnt_unit_t unit ) : _pcnt_unit( unit ), _lastCount( 0 ) {}
-
-        //Reset stored counter value to 0
-        void reset() { _lastCount = 0; }
-
-        //Get stored last counter value
-        int16_t getLastCount() { return _lastCount; }
-
-        //Check for count stalling
-        bool isStalled() { 
-            int16_t newCount;
-            //Get counter value from pulse count peripheral register
-            pcnt_get_counter_value ( _pcnt_unit, &newCount );
-            //Comapre last count and new count
-            if( newCount == _lastCount) {
-                return true;
-            } else {
-                //Save new count as last count
-                _lastCount = newCount;
-                return false;
+        //One-shot timer. Re-arms itself for the rest of the window if a milestone was reached meanwhile, stops the motor otherwise
+        static void timerCallback(void* arg) {
+
+            StallGuard* guard = (StallGuard*) arg;
+
+            //Target position was reached before
+            if( !_moving )
+                return;
+
+            int64_t deadline = guard->_lastMilestone + VALVE_STALL_WINDOW_MS * 1000LL;
+            int64_t now = valveHal_time();
+
+            if( deadline > now ) {
+                valveHal_timerOnce( guard->_timer, deadline - now );
+                return;
             }
+
+            //No movement within the window -> Stop motor right here, unless the target isr was faster
+            if( !__atomic_exchange_n( &_moving, 0, __ATOMIC_ACQ_REL ) )
+                return;
+
+            guard->_stalled = true;
+            valve_halt();
+
+            //Wake up waiting movement
+            valveHal_lockGive( valveDone );
+        }
+
+    public:
+        StallGuard() : _timer( NULL ), _lastMilestone( 0 ), _stalled( false ) {}
+
+        //Create timer
+        void init() {
+            _timer = valveHal_timerCreate( timerCallback, this, "stallGuard" );
+        }
+
+        //Watch a movement which starts now, the first milestone is expected within the spin up. A motor blocked from the
+        //start, e.g. at the endstop, is stopped after VALVE_SPINUP_MS
+        void arm() {
+
+            _stalled = false;
+            _lastMilestone = valveHal_time() + ( VALVE_SPINUP_MS - VALVE_STALL_WINDOW_MS ) * 1000LL;
+
+            valveHal_timerOnce( _timer, VALVE_SPINUP_MS * 1000ULL );
+        }
+
+        //Stop watching
+        void disarm() {
+            valveHal_timerStop( _timer );
+        }
+
+        //Called from the counter isr
+        void IRAM_ATTR milestone() {
+            _lastMilestone = valveHal_time();
         }
 
+        //Movement ended by a stall
+        bool isStalled() { return _stalled; }
+
 };
 
-static void IRAM_ATTR pcnt_valve_intr_handler(void* arg) {
+static StallGuard stallGuard;
+
+//Speed control loop: accelerate from VALVE_SPEED_MIN to VALVE_SPEED_MAX and ramp down over the last VALVE_RAMP_COUNTS,
+//so the motor reaches the target slowly and does not overrun it by inertia
+static void valve_control(void* arg) {
+
+    if( !_moving )
+        return;
+
+    uint32_t limit = VALVE_SPEED_MAX;
+
+    //Reduce speed linear to the remaining counts
+    if( _rampCounts > 0 ) {
+
+        int32_t remaining = _rampCounts - valveHal_counterGet();
+        if( remaining < 0 )
+            remaining = 0;
+
+        if( remaining < VALVE_RAMP_COUNTS )
+            limit = VALVE_SPEED_MIN + ( VALVE_SPEED_MAX - VALVE_SPEED_MIN ) * remaining / VALVE_RAMP_COUNTS;
+    }
+
+    //Accelerate with the configured slope, slow down at once
+    uint32_t speed = _speed + VALVE_ACCELERATION;
+    if( speed > limit )
+        speed = limit;
+
+    if( speed != _speed ) {
+        _speed = speed;
+        valveHal_motorSpeed( _speed );
+    }
+}
+
+//Milestone counter wrapped -> Motor is moving
+static void IRAM_ATTR valve_milestone_isr() {
+    stallGuard.milestone();
+}
+
+//Target position reached
+static void IRAM_ATTR valve_target_isr() {
+
+    //Stall guard stopped the motor already
+    if( !__atomic_exchange_n( &_moving, 0, __ATOMIC_ACQ_REL ) )
+        return;
 
     //Stop motor move
-    motor.stop();
+    valveHal_motorStop();
 
-    // Disable reflex source
-    board_setReflexEn( false );
+    //Disable target, the counters keep counting the coasting motor
+    valveHal_counterDisarm();
 
-    //Stop counter
-    pcnt_counter_pause ( pcnt_unit );
+    //Wake up waiting movement
+    valveHal_lockGiveFromIsr( valveDone );
+}
+
+//Drive motor until the target counts are reached or the motor stalls. With untilStall the target counts only slow down
+//the motor, so it reaches the endstop gently (target 0 = till stall at full speed). Valve lock must be taken
+static void valve_move(uint8_t direction, int16_t targetCounts, bool untilStall) {
 
-    // Disable event because we reached the target position
-    pcnt_event_disable( pcnt_unit, PCNT_EVT_THRES_1 );
+    //Drop a completion given late by the previous movement, e.g. after its timeout
+    valveHal_lockTake( valveDone, 0 );
 
-    // Release lock
-    BaseType_t xHigherPriorityTaskWoken;
-    xHigherPriorityTaskWoken = pdFALSE;
+    //Enable reflex source
+    valveHal_reflexEnable( true );
+
+    //Count from zero to the target
+    valveHal_counterStart( untilStall ? 0 : targetCounts );
+
+    //Start motor movement with the speed profile and watch it
+    _rampCounts = targetCounts;
+    _speed = VALVE_SPEED_MIN;
+    _moving = 1;
+    valveHal_motorStart( direction, _speed );
+    stallGuard.arm();
+    valveHal_timerPeriodic( controlTimer, VALVE_CONTROL_PERIOD_MS * 1000ULL );
+
+    //Wait till the isr or the stall guard stopped the motor
+    if( !valveHal_lockTake( valveDone, VALVE_MOVE_TIMEOUT_MS ) ) {
+        ESP_LOGE( "VALVE", "Movement timeout" );
+    }
 
-    //Clear interrtupt
-    PCNT.int_clr.val = PCNT.int_st.val;
+    valveHal_timerStop( controlTimer );
+    stallGuard.disarm();
 
-    xSemaphoreGiveFromISR( valveLock, &xHigherPriorityTaskWoken );
+    //Count the motor coasting after the target, so the position includes the overrun
+    if( !stallGuard.isStalled() )
+        valveHal_delay( VALVE_COAST_MS );
 
-    if( xHigherPriorityTaskWoken == pdTRUE )
-        portYIELD_FROM_ISR( );
+    //Stopped already if the movement was done, otherwise stop after timeout
+    valve_halt();
 }
 
 void valve_init() {
 
     //Create lock for valve regulation
-    valveLock = xSemaphoreCreateBinary();
-    
-    if( valveLock == NULL ) {
+    valveLock = valveHal_lockCreate();
+
+    //Completion of a movement, taken till the motor is stopped
+    valveDone = valveHal_lockCreate();
+
+    if( valveLock == NULL || valveDone == NULL ) {
         ESP_LOGE( "VALVE", "Semaphore creation failed" );
     } else {
-        //Give semaphore after creation to unlock it
-        xSemaphoreGive( valveLock );
+        valveHal_lockTake( valveDone, 0 );
     }
 
-    //Configuration for positive incremnt on active low reflex signal
-    pcnt_config_t pcnt_config = {
-        .pulse_gpio_num = REFLEX_SIG, //PCNT_PIN_NOT_USED
-        .ctrl_gpio_num = PCNT_PIN_NOT_USED, //0x38 = //Const high level input (see esp32 technical reference manual 4.2.2)
-        .lctrl_mode = PCNT_MODE_KEEP,
-        .hctrl_mode = PCNT_MODE_KEEP,
-        .pos_mode = PCNT_COUNT_INC,
-        .neg_mode = PCNT_COUNT_INC,
-        .counter_h_lim = INT16_MAX,
-        .counter_l_lim = INT16_MIN,
-        .unit = pcnt_unit,
-        .channel = PCNT_CHANNEL_0
-    };
-
-    pcnt_unit_config( &pcnt_config );
-
-    //Optional configure and enable input filter
-    pcnt_set_filter_value( pcnt_unit, 10 );
-    pcnt_filter_enable( pcnt_unit );
-
-    //Register callback event
-    pcnt_isr_register( pcnt_valve_intr_handler, NULL, ESP_INTR_FLAG_LEVEL3 | ESP_INTR_FLAG_IRAM, NULL ); 
-    //Enable ISR
-    pcnt_intr_enable( pcnt_unit );
+    //Position counter and milestone counter for the stall guard on the reflex signal
+    valveHal_counterInit( valve_target_isr, valve_milestone_isr );
+    stallGuard.init();
+
+    //Motor speed by pwm on the enable pin and its control loop
+    valveHal_motorInit();
+    controlTimer = valveHal_timerCreate( valve_control, NULL, "valveCtrl" );
 
     //Print stored vlaues for valve position and maxi counts from RTC Ram
     ESP_LOGD( "VALVE", "RTC RAM max_conuts: %u", _maxCounts );
-    ESP_LOGD( "VALVE", "RTC RAM _valvePosition: %u", _valvePosition );
+    ESP_LOGD( "VALVE", "RTC RAM _position: %d", _position );
     
 }
 
-//Set valve poisition 0-100% (0 = closed, 100 = Open), return true ond success, otherwise false
-bool valve_set(uint8_t percent) {
+//Estimated position error in counts since the last endstop contact
+static uint32_t valve_drift() {
+    return (uint64_t) _travelSinceSync * _driftRate / 1000;
+}
+
+//Counts from the closed endstop of a position in permille, rounded
+static int32_t valve_toCounts(uint16_t permille) {
+    return ( permille * _maxCounts + VALVE_PERMILLE_MAX / 2 ) / VALVE_PERMILLE_MAX;
+}
+
+//Valve stalled at the endstop in direction, so the position is exact again. A stroke from the other endstop refreshes
+//max counts, otherwise the deviation from the expected counts is learned as drift rate
+static void valve_sync(uint8_t direction, int32_t expectedCounts, int32_t measuredCounts) {
+
+    if( _travelSinceSync == 0 && _position == ( direction == OPEN ? 0 : (int32_t) _maxCounts ) ) {
+
+        ESP_LOGD( "VALVE", "Stroke %d counts, was %u", measuredCounts, _maxCounts );
+
+        _maxCounts = measuredCounts;
+        _strokeMoves = 0;
+
+    } else if( _travelSinceSync > 0 ) {
+
+        //Observed error per 1000 counts, smoothed over the last syncs
+        uint32_t observed = abs( measuredCounts - expectedCounts ) * 1000 / _travelSinceSync;
+        if( observed > 1000 )
+            observed = 1000;
+
+        _driftRate = ( 3 * _driftRate + observed ) / 4;
+
+        ESP_LOGD( "VALVE", "Synced with %d counts error after %u counts, drift rate %u", measuredCounts - expectedCounts, _travelSinceSync, _driftRate );
+    }
+
+    _position = direction == OPEN ? _maxCounts : 0;
+    _travelSinceSync = 0;
+}
+
+bool valve_setPermille(uint16_t permille) {
 
     //if valve was not initalized the maxCounts is not set. No regualtion possible so return false
     if( _maxCounts == 0 )
         return false;
 
     //Set target postion to 100% if parameter ist >100%
-    if( percent > 100)
-        percent = 100;
+    if( permille > VALVE_PERMILLE_MAX )
+        permille = VALVE_PERMILLE_MAX;
+
+    int32_t targetCounts = valve_toCounts( permille );
 
     //Valveposition is already correct
-    if( _valvePosition == percent )
+    if( _position == targetCounts )
         return true;
 
     //Get lock but wait max. 0.1 seconds
-    if( xSemaphoreTake( valveLock, DELAY_MS(100) ) != pdTRUE )
+    if( !valveHal_lockTake( valveLock, 100 ) )
         return false;
 
-    //Calculate realtive counts for target position
-    int16_t relativeCounts = (_maxCounts/100) * (_valvePosition - percent);
+    //Set direction: opening for positive counts, closing for negative counts
+    uint8_t direction = targetCounts > _position ? OPEN : CLOSE;
 
-    //Set direction: opening for negative counts, closing for positive counts
-    uint8_t direction = relativeCounts < 0 ? OPEN : CLOSE;
+    //Counts to move, the stroke is within the range of the 16 bit counter
+    int16_t relativeCounts = abs( targetCounts - _position );
 
-    //set relative count to absoulte value
-    relativeCounts = abs( relativeCounts );
-
-    //Create stallguard
-    StallGuard stallGuard( pcnt_unit );
+    //Moves to an endstop continue till the stall, which resyncs the position for free
+    bool endstop = permille == 0 || permille == VALVE_PERMILLE_MAX;
 
     /* Start regulation */
 
-    //Enable reflex source
-    board_setReflexEn( true );  
+    //Returns when the target is reached or the motor stalled
+    valve_move( direction, relativeCounts, endstop );
 
-    //Set target value
-    pcnt_set_event_value( pcnt_unit, PCNT_EVT_THRES_1, relativeCounts );
-    //Enable event
-    pcnt_event_enable( pcnt_unit, PCNT_EVT_THRES_1 );
-    
-    //Clear pulse counter
-    pcnt_counter_pause ( pcnt_unit );
-    pcnt_counter_clear( pcnt_unit ); 
-
-    //Resume counter
-    pcnt_counter_resume ( pcnt_unit );
+    //Get real counter value to calculate position and failure
+    int16_t measuredCounts = valveHal_counterGet();
 
-    //Start motor movement
-    motor.start( direction );
+    _strokeMoves++;
 
-    //Wait for target position is reached but check for stalling each 0.5 Seconds
-    while( xSemaphoreTake( valveLock, DELAY_MS(500) ) != pdTRUE && stallGuard.isStalled() != true )
-    {
-        ESP_LOGD( "VALVE", "Regulation counts: %u/%u", stallGuard.getLastCount(), relativeCounts );
-    }
+    //Endstop reached
+    if( endstop && stallGuard.isStalled() ) {
 
-    //Get real counter value to calculate position and failure
-    int16_t measuredCounts = 0;
-    pcnt_get_counter_value( pcnt_unit, &measuredCounts );
-    
-    //Counter value is not equal to desired one -> regulation faied. Current valve position will be recalculated
-    if( measuredCounts != relativeCounts ) {
-
-        ESP_LOGE( "VALVE", "Regulation failed: Conuter %u/%u", measuredCounts, relativeCounts );
-
-        /* Regulation failed -> Abort action and cleanup*/
-        //Stop motor
-        motor.stop();
-        
-        //Disable reflex source
-        board_setReflexEn( false );
-        
-        //pause and reset counter
-        pcnt_counter_pause ( pcnt_unit );
-        pcnt_counter_clear( pcnt_unit );
-
-        //Disable event
-        pcnt_event_disable( pcnt_unit, PCNT_EVT_THRES_1 );
-
-        //Calculate relative valve position
-        int8_t relPosition = measuredCounts / (_maxCounts/100);
-        //Add relPosition on valven opening, Substract relPosition on valve closing
-        _valvePosition += direction == OPEN ? relPosition : -relPosition; 
+        valve_sync( direction, relativeCounts, measuredCounts );
 
         //release lock
-        xSemaphoreGive( valveLock );
+        valveHal_lockGive( valveLock );
 
-        return false;
+        return true;
+    }
 
-    } else {
+    //Counted move stalled where the drift model expects the endstop -> Sync there although the target is missed
+    if( stallGuard.isStalled() ) {
 
-        ESP_LOGD( "VALVE", "Regulation done" );
+        int32_t endstopCounts = direction == OPEN ? _maxCounts - _position : _position;
 
-        // Save actual postion
-        _valvePosition = percent;
+        if( (uint32_t) abs( endstopCounts - measuredCounts ) <= valve_drift() + VALVE_STALL_PULSES ) {
 
-        //release lock
-        xSemaphoreGive( valveLock );
+            ESP_LOGW( "VALVE", "Endstop reached at %d of %d counts", measuredCounts, relativeCounts );
 
-        return true;
-        
+            valve_sync( direction, endstopCounts, measuredCounts );
+
+            //release lock
+            valveHal_lockGive( valveLock );
+
+            return false;
+        }
     }
-}
 
-//Init valve by extract and retract the valve till max
-bool valve_calibration() {
+    _travelSinceSync += measuredCounts;
 
-    //Skip calibration if maxCount is already set
-    if( _maxCounts != 0)
-        return true;
+    //Counts actually moved including the overrun
+    _position += direction == OPEN ? measuredCounts : -measuredCounts;
+
+    //Keep position within the stroke
+    if( _position < 0 )
+        _position = 0;
+    if( _position > (int32_t) _maxCounts )
+        _position = _maxCounts;
 
-    //Create stallguard
-    StallGuard stallGuard( pcnt_unit );
+    //release lock
+    valveHal_lockGive( valveLock );
 
-    //Enable reflex light source
-    board_setReflexEn( true );
+    //Target not reached -> regulation faied, position follows the measured counts
+    if( measuredCounts < relativeCounts ) {
+        ESP_LOGE( "VALVE", "Regulation failed: Conuter %d/%d%s", measuredCounts, relativeCounts, stallGuard.isStalled() ? ", stalled" : "" );
+        return false;
+    }
 
-    //clear pcnt counter
-    pcnt_counter_pause ( pcnt_unit );
-    pcnt_counter_clear( pcnt_unit );
-    pcnt_counter_resume ( pcnt_unit );
+    ESP_LOGD( "VALVE", "Regulation done" );
+
+    return true;
+}
 
-    //Drive motor to full open
-    motor.start( OPEN );
-    //Wait motor spin
-    vTaskDelay( DELAY_MS(500) );
+//Set valve poisition 0-100% (0 = closed, 100 = Open), return true ond success, otherwise false
+bool valve_set(uint8_t percent) {
 
-    //Move until no pulses where detected -> We reached 100%
-    do {
-        vTaskDelay( DELAY_MS(25) );
-    } while( !stallGuard.isStalled() );
+    if( percent > 100 )
+        percent = 100;
 
-    motor.stop();
+    return valve_setPermille( percent * 10 );
+}
 
-    //Wait 1 second for motor and all gears stopped
-    vTaskDelay( DELAY_MS(1000) );
+//Init valve by extract and retract the valve till max
+bool valve_calibration() {
 
-    //Now that we reached 100%, we must find 0% position
+    //Get lock but wait max. 0.1 seconds
+    if( !valveHal_lockTake( valveLock, 100 ) )
+        return false;
 
-    //clear pcnt counter, so we start at 100%
-    pcnt_counter_pause ( pcnt_unit );
-    pcnt_counter_clear( pcnt_unit );
-    pcnt_counter_resume ( pcnt_unit );
+    //Drive motor to full open, until no pulses where detected -> We reached 100%
+    valve_move( OPEN, 0, true );
 
-    //Reset stallguard for new movement
-    stallGuard.reset();
+    //Wait 1 second for motor and all gears stopped
+    valveHal_delay( 1000 );
 
-    //Drive motor to full closed
-    motor.start( CLOSE );
-    //Wait motor spin
-    vTaskDelay( DELAY_MS(500) );
+    //Now that we reached 100%, we must find 0% position
 
-    //Move until no pulses where detected
-    do {
-        vTaskDelay( DELAY_MS(25) );
-    } while( !stallGuard.isStalled() );
+    //Drive motor to full closed, counter starts at 100%
+    valve_move( CLOSE, 0, true );
 
-    motor.stop();
+    int16_t counts = valveHal_counterGet();
 
-    board_setReflexEn( false );
+    //release lock
+    valveHal_lockGive( valveLock );
 
-    //If stallGuard counter is still 0, something went wrong (e.g. no motor movement, sensor failed)
-    if( stallGuard.getLastCount() == 0 )
+    //If counter is still 0, something went wrong (e.g. no motor movement, sensor failed)
+    if( counts <= 0 )
         return false;
 
     //Store counts for a full valve move
-    _maxCounts = stallGuard.getLastCount();
+    _maxCounts = counts;
     //Set actual valve position to fully closed
-    _valvePosition = 0;
+    _position = 0;
+
+    //Position and stroke are exact now
+    _travelSinceSync = 0;
+    _strokeMoves = 0;
 
     ESP_LOGD( "VALVE", "Max CNT: %d", _maxCounts );
 
     return true;
 }
 
+bool valve_calibrationDue() {
+
+    //Not calibrated at all
+    if( _maxCounts == 0 )
+        return true;
+
+    //Stroke may have changed by gear wear
+    if( _strokeMoves >= VALVE_STROKE_MAX_MOVES )
+        return true;
+
+    //Estimated position error since the last endstop contact
+    return valve_drift() > _maxCounts * VALVE_DRIFT_LIMIT / 100;
+}
+
+uint16_t valve_getPermille() {
+
+    if( _maxCounts == 0 )
+        return 0;
+
+    return ( _position * VALVE_PERMILLE_MAX + _maxCounts / 2 ) / _maxCounts;
+}
+
 //Get the actual valve position from 0 to 100%
 uint8_t valve_get() {
-    return _valvePosition;
+    return ( valve_getPermille() + 5 ) / 10;
+}
+
+uint16_t valve_getDriftPermille() {
+
+    if( _maxCounts == 0 )
+        return VALVE_PERMILLE_MAX;
+
+    uint64_t drift = (uint64_t) valve_drift() * VALVE_PERMILLE_MAX / _maxCounts;
+
+    return drift > VALVE_PERMILLE_MAX ? VALVE_PERMILLE_MAX : drift;
 }
 
 //Get max counts
@@ -3,6 +3,9 @@
 
 #include <stdint.h>
 
+//Valve position in 0.1% steps
+#define VALVE_PERMILLE_MAX 1000
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -13,8 +16,17 @@ void valve_init();
 bool valve_set(uint8_t percent);
 //Get the actual valve position from 0 to 100%
 uint8_t valve_get();
-//Init valve by extract and retract the valve till max
+//Set valve position in 0.1% steps from 0 to VALVE_PERMILLE_MAX, return true on success, otherwise false
+bool valve_setPermille(uint16_t permille);
+//Get the actual valve position in 0.1% steps, the position is kept in encoder counts
+uint16_t valve_getPermille();
+//Estimated position error since the last endstop contact in 0.1% of the stroke
+uint16_t valve_getDriftPermille();
+//Init valve by extract and retract the valve till max, blocks for the full stroke
 bool valve_calibration();
+//True if a full calibration is needed. Moves to 0 or 100% resync the position at the endstop and a stroke between both endstops
+//refreshes the max counts, so this is only due on a large estimated drift or a stroke which was not measured for long
+bool valve_calibrationDue();
 //Get max counts
 uint32_t valve_getMaxCounts();
 
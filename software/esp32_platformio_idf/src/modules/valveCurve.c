@@ -0,0 +1,250 @@
+#include "valveCurve.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <math.h>
+#include <sys/time.h>
+#include "nvs.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "board/config.h"
+#include "valve.h"
+
+static const char *TAG = "CURVE";
+static const char *NVS_NAMESPACE = "valve";
+static const char *NVS_KEY = "curve";
+
+//Stroke between two points of the table
+#define VALVE_CURVE_STEP ( VALVE_PERMILLE_MAX / ( VALVE_CURVE_POINTS - 1 ) )
+
+//Table as stored in NVS
+typedef struct {
+    uint16_t effect[VALVE_CURVE_POINTS]; //Effect at the stroke points
+    float gain; //Temperature trend in °C/h of the full effect, 0 = not learned yet
+} valveCurve_table_t;
+
+_Static_assert( VALVE_CURVE_POINTS == 6, "default table must match the count of points" );
+_Static_assert( VALVE_PERMILLE_MAX % ( VALVE_CURVE_POINTS - 1 ) == 0, "stroke points must be evenly spaced" );
+
+//Quick opening default, effect = 1 - (1 - stroke)^2
+static const valveCurve_table_t defaultTable = { { 0, 360, 640, 840, 960, 1000 }, 0 };
+
+//Keep table and observations in rtc ram, this memory will not be cleared by deep-sleep
+static RTC_DATA_ATTR valveCurve_table_t _table;
+static RTC_DATA_ATTR bool _loaded;
+static RTC_DATA_ATTR uint8_t _updates; //Learned updates which are not written to NVS yet
+
+//Interval since the last observation, the valve keeps its stroke meanwhile
+static RTC_DATA_ATTR float _lastTemperature;
+static RTC_DATA_ATTR time_t _lastTime; //0 = No observation yet
+static RTC_DATA_ATTR uint16_t _intervalStroke;
+
+//Temperature trend of the previous interval
+static RTC_DATA_ATTR bool _trendValid;
+static RTC_DATA_ATTR float _trend; //°C/h
+static RTC_DATA_ATTR uint16_t _trendStroke;
+
+//Seconds since boot, keeps counting during deep-sleep
+static time_t valveCurve_now() {
+    struct timeval tv;
+    gettimeofday( &tv, NULL );
+    return tv.tv_sec;
+}
+
+static void valveCurve_save() {
+
+    nvs_handle handle;
+
+    if( nvs_open( NVS_NAMESPACE, NVS_READWRITE, &handle ) != ESP_OK ) {
+        ESP_LOGW( TAG, "NVS open failed" );
+        return;
+    }
+
+    if( nvs_set_blob( handle, NVS_KEY, &_table, sizeof(_table) ) == ESP_OK && nvs_commit( handle ) == ESP_OK ) {
+        _updates = 0;
+    } else {
+        ESP_LOGW( TAG, "NVS write failed" );
+    }
+
+    nvs_close( handle );
+}
+
+//Stored table is usable: fixed end points, strictly increasing and a finite gain
+static bool valveCurve_valid(const valveCurve_table_t* table) {
+
+    if( table->effect[0] != 0 || table->effect[VALVE_CURVE_POINTS - 1] != VALVE_PERMILLE_MAX )
+        return false;
+
+    for( int i = 1; i < VALVE_CURVE_POINTS; i++ ) {
+        if( table->effect[i] <= table->effect[i - 1] )
+            return false;
+    }
+
+    return isfinite( table->gain ) && table->gain >= 0;
+}
+
+void valveCurve_init() {
+
+    if( _loaded )
+        return;
+
+    _loaded = true;
+    _table = defaultTable;
+
+    nvs_handle handle;
+
+    if( nvs_open( NVS_NAMESPACE, NVS_READONLY, &handle ) != ESP_OK ) {
+        ESP_LOGD( TAG, "No stored curve, using default" );
+        return;
+    }
+
+    //Ignore a table of another layout or with broken values, e.g. written by another firmware
+    valveCurve_table_t table;
+    size_t size = sizeof(table);
+
+    if( nvs_get_blob( handle, NVS_KEY, &table, &size ) == ESP_OK && size == sizeof(table) ) {
+        if( valveCurve_valid( &table ) )
+            _table = table;
+        else
+            ESP_LOGW( TAG, "Stored curve invalid, using default" );
+    }
+
+    nvs_close( handle );
+
+    ESP_LOGD( TAG, "Curve %u/%u/%u/%u/%u/%u, gain %.2f °C/h", _table.effect[0], _table.effect[1], _table.effect[2],
+              _table.effect[3], _table.effect[4], _table.effect[5], _table.gain );
+}
+
+uint16_t valveCurve_toEffect(uint16_t stroke) {
+
+    if( stroke >= VALVE_PERMILLE_MAX )
+        return _table.effect[VALVE_CURVE_POINTS - 1];
+
+    uint8_t i = stroke / VALVE_CURVE_STEP;
+    uint16_t offset = stroke - i * VALVE_CURVE_STEP;
+
+    return _table.effect[i] + ( _table.effect[i + 1] - _table.effect[i] ) * offset / VALVE_CURVE_STEP;
+}
+
+uint16_t valveCurve_toStroke(uint16_t effect) {
+
+    if( effect >= _table.effect[VALVE_CURVE_POINTS - 1] )
+        return VALVE_PERMILLE_MAX;
+
+    //Segment containing the effect, the table is strictly increasing
+    uint8_t i = 0;
+    while( effect >= _table.effect[i + 1] )
+        i++;
+
+    uint16_t rise = _table.effect[i + 1] - _table.effect[i];
+
+    return i * VALVE_CURVE_STEP + ( ( effect - _table.effect[i] ) * VALVE_CURVE_STEP + rise / 2 ) / rise;
+}
+
+//Valve moved from one stroke to another and changed the temperature trend. Segments passed by the move are made steeper if
+//the change is stronger than the average gain predicts, flatter if it is weaker
+static void valveCurve_learn(uint16_t from, uint16_t to, float trendChange) {
+
+    int32_t effectChange = valveCurve_toEffect( to ) - valveCurve_toEffect( from );
+
+    if( abs( effectChange ) < VALVE_CURVE_MIN_STEP )
+        return;
+
+    //Trend change of the full effect
+    float gain = trendChange * VALVE_PERMILLE_MAX / effectChange;
+
+    //Temperature moved against the valve, e.g. by an opened window -> Not related to the valve
+    if( gain <= 0 )
+        return;
+
+    //First move only sets the average gain
+    if( _table.gain <= 0 ) {
+        _table.gain = gain;
+        return;
+    }
+
+    //Limit the influence of a single noisy observation
+    float ratio = gain / _table.gain;
+    if( ratio < 0.5f )
+        ratio = 0.5f;
+    if( ratio > 2.0f )
+        ratio = 2.0f;
+
+    _table.gain *= 1 + ( ratio - 1 ) * VALVE_CURVE_LEARN_RATE / 100;
+
+    int32_t low = from < to ? from : to;
+    int32_t high = from < to ? to : from;
+
+    float rise[VALVE_CURVE_POINTS - 1];
+    float total = 0;
+
+    for( int i = 0; i < VALVE_CURVE_POINTS - 1; i++ ) {
+
+        rise[i] = _table.effect[i + 1] - _table.effect[i];
+
+        //Part of the segment passed by the move
+        int32_t start = i * VALVE_CURVE_STEP;
+        int32_t end = start + VALVE_CURVE_STEP;
+        int32_t overlap = ( end < high ? end : high ) - ( start > low ? start : low );
+
+        if( overlap > 0 )
+            rise[i] *= 1 + ( ratio - 1 ) * VALVE_CURVE_LEARN_RATE / 100 * overlap / VALVE_CURVE_STEP;
+
+        total += rise[i];
+    }
+
+    //Scale to the full effect again, the first and last point stay fixed and the table stays strictly increasing
+    float effect = 0;
+
+    for( int i = 1; i < VALVE_CURVE_POINTS - 1; i++ ) {
+
+        effect += rise[i - 1] * VALVE_PERMILLE_MAX / total;
+
+        int32_t value = lroundf( effect );
+        if( value <= _table.effect[i - 1] )
+            value = _table.effect[i - 1] + 1;
+        if( value > VALVE_PERMILLE_MAX - ( VALVE_CURVE_POINTS - 1 - i ) )
+            value = VALVE_PERMILLE_MAX - ( VALVE_CURVE_POINTS - 1 - i );
+
+        _table.effect[i] = value;
+    }
+
+    ESP_LOGD( TAG, "Learned %u->%u, gain %.2f °C/h: %u/%u/%u/%u/%u/%u", from, to, _table.gain, _table.effect[0], _table.effect[1],
+              _table.effect[2], _table.effect[3], _table.effect[4], _table.effect[5] );
+
+    //Save flash write cycles
+    if( ++_updates >= VALVE_CURVE_SAVE_UPDATES )
+        valveCurve_save();
+}
+
+void valveCurve_observe(float temperature, uint16_t stroke) {
+
+    time_t now = valveCurve_now();
+    time_t interval = now - _lastTime;
+
+    //Too short for a trend, the interval continues if the valve was not moved
+    if( _lastTime != 0 && interval < VALVE_CURVE_MIN_INTERVAL && stroke == _intervalStroke )
+        return;
+
+    if( _lastTime != 0 && interval >= VALVE_CURVE_MIN_INTERVAL && interval <= VALVE_CURVE_MAX_INTERVAL ) {
+
+        //Trend of the finished interval, the valve kept its stroke meanwhile
+        float trend = ( temperature - _lastTemperature ) * 3600 / interval;
+
+        //Valve was moved between the previous and the finished interval
+        if( _trendValid && _intervalStroke != _trendStroke )
+            valveCurve_learn( _trendStroke, _intervalStroke, trend - _trend );
+
+        _trend = trend;
+        _trendStroke = _intervalStroke;
+        _trendValid = true;
+
+    } else {
+        //First observation, valve moved within a short interval or the last observation is too old
+        _trendValid = false;
+    }
+
+    _lastTemperature = temperature;
+    _lastTime = now;
+    _intervalStroke = stroke;
+}
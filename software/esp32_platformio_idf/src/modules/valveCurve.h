@@ -0,0 +1,38 @@
+#ifndef VALVECURVE_H
+#define VALVECURVE_H
+
+#include <stdint.h>
+
+/* Characteristic curve of the radiator valve: heating effect over the stroke, both in 0.1% steps.
+
+Piecewise linear table with VALVE_CURVE_POINTS evenly spaced stroke points, stored in NVS. Most radiator valves change the
+flow in the first part of the stroke, so the default table is quick opening. The table is learned online: after a valve move
+the change of the temperature trend is compared with the change of the effect the table predicts.
+
+*/
+
+//Points of the table, the first and the last point are fixed to 0 and 100% effect
+#define VALVE_CURVE_POINTS 6
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//Load table from NVS, only on the first call after power up. The table is kept in rtc ram during deep-sleep
+void valveCurve_init();
+
+//Heating effect of a valve stroke
+uint16_t valveCurve_toEffect(uint16_t stroke);
+
+//Valve stroke for a heating effect, used to linearise the controller output
+uint16_t valveCurve_toStroke(uint16_t effect);
+
+//Temperature at the start of the cycle and the valve stroke after all moves of the cycle. Learns the table from the trends
+//of the intervals between the observations
+void valveCurve_observe(float temperature, uint16_t stroke);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //VALVECURVE_H
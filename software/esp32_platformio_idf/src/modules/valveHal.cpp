@@ -0,0 +1,208 @@
+#include "valveHal.h"
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/portmacro.h"
+#include "freertos/task.h"
+#include "pcnt.h" //Pulse counter
+#include "esp_timer.h"
+#include "esp_attr.h"
+#include "board/board.h"
+#include "board/config.h"
+#include "driver/drv883x.h"
+
+static const pcnt_unit_t pcnt_unit = PCNT_UNIT_0;
+static const pcnt_unit_t pcnt_stall_unit = PCNT_UNIT_1;
+static DRV883X motor( MOTOR_ENABLE, MOTOR_PHASE, MOTOR_nSLEEP );
+
+static valveHal_isr_t _onTarget;
+static valveHal_isr_t _onMilestone;
+
+//A task was woken by the isr callbacks
+static BaseType_t _isrWoken;
+
+static void IRAM_ATTR pcnt_valve_intr_handler(void* arg) {
+
+    //Get and clear interrupts of all units
+    uint32_t status = PCNT.int_st.val;
+    PCNT.int_clr.val = status;
+
+    _isrWoken = pdFALSE;
+
+    //Stall unit wrapped -> Motor is moving
+    if( status & BIT(pcnt_stall_unit) )
+        _onMilestone();
+
+    //Target position reached
+    if( status & BIT(pcnt_unit) )
+        _onTarget();
+
+    if( _isrWoken == pdTRUE )
+        portYIELD_FROM_ISR( );
+}
+
+//Count both edges of the active low reflex signal
+static void counter_config(pcnt_unit_t unit, int16_t highLimit, int16_t lowLimit) {
+
+    pcnt_config_t pcnt_config = {
+        .pulse_gpio_num = REFLEX_SIG,
+        .ctrl_gpio_num = PCNT_PIN_NOT_USED, //0x38 = //Const high level input (see esp32 technical reference manual 4.2.2)
+        .lctrl_mode = PCNT_MODE_KEEP,
+        .hctrl_mode = PCNT_MODE_KEEP,
+        .pos_mode = PCNT_COUNT_INC,
+        .neg_mode = PCNT_COUNT_INC,
+        .counter_h_lim = highLimit,
+        .counter_l_lim = lowLimit,
+        .unit = unit,
+        .channel = PCNT_CHANNEL_0
+    };
+
+    pcnt_unit_config( &pcnt_config );
+
+    //Optional configure and enable input filter
+    pcnt_set_filter_value( unit, 10 );
+    pcnt_filter_enable( unit );
+}
+
+void valveHal_counterInit(valveHal_isr_t onTarget, valveHal_isr_t onMilestone) {
+
+    _onTarget = onTarget;
+    _onMilestone = onMilestone;
+
+    counter_config( pcnt_unit, INT16_MAX, INT16_MIN );
+
+    //Counter is reset on the high limit, each reset is a milestone
+    counter_config( pcnt_stall_unit, VALVE_STALL_PULSES, 0 );
+    pcnt_event_enable( pcnt_stall_unit, PCNT_EVT_H_LIM );
+
+    //Register callback event
+    pcnt_isr_register( pcnt_valve_intr_handler, NULL, ESP_INTR_FLAG_LEVEL3 | ESP_INTR_FLAG_IRAM, NULL );
+    //Enable ISR
+    pcnt_intr_enable( pcnt_unit );
+    pcnt_intr_enable( pcnt_stall_unit );
+}
+
+void valveHal_counterStart(int16_t target) {
+
+    //Set target value
+    if( target > 0 ) {
+        pcnt_set_event_value( pcnt_unit, PCNT_EVT_THRES_1, target );
+        pcnt_event_enable( pcnt_unit, PCNT_EVT_THRES_1 );
+    } else {
+        pcnt_event_disable( pcnt_unit, PCNT_EVT_THRES_1 );
+    }
+
+    //Clear pulse counters
+    pcnt_counter_pause( pcnt_unit );
+    pcnt_counter_pause( pcnt_stall_unit );
+    pcnt_counter_clear( pcnt_unit );
+    pcnt_counter_clear( pcnt_stall_unit );
+
+    //Resume counters
+    pcnt_counter_resume( pcnt_unit );
+    pcnt_counter_resume( pcnt_stall_unit );
+}
+
+void IRAM_ATTR valveHal_counterStop() {
+
+    pcnt_counter_pause( pcnt_unit );
+    pcnt_counter_pause( pcnt_stall_unit );
+
+    //Disable event because the movement is done
+    pcnt_event_disable( pcnt_unit, PCNT_EVT_THRES_1 );
+}
+
+void IRAM_ATTR valveHal_counterDisarm() {
+    pcnt_event_disable( pcnt_unit, PCNT_EVT_THRES_1 );
+}
+
+int16_t valveHal_counterGet() {
+
+    int16_t counts = 0;
+    pcnt_get_counter_value( pcnt_unit, &counts );
+
+    return counts;
+}
+
+void valveHal_motorInit() {
+    motor.enablePwm( LEDC_TIMER_0, LEDC_CHANNEL_0, VALVE_PWM_FREQUENCY );
+}
+
+void valveHal_motorStart(uint8_t direction, uint8_t speed) {
+    motor.start( direction, speed );
+}
+
+void valveHal_motorSpeed(uint8_t speed) {
+    motor.speed( speed );
+}
+
+void IRAM_ATTR valveHal_motorStop() {
+    motor.stop();
+}
+
+void IRAM_ATTR valveHal_reflexEnable(bool enable) {
+    board_setReflexEn( enable );
+}
+
+int64_t IRAM_ATTR valveHal_time() {
+    return esp_timer_get_time();
+}
+
+valveHal_timer_t valveHal_timerCreate(valveHal_timerCallback_t callback, void* arg, const char* name) {
+
+    esp_timer_create_args_t timer_args = {};
+    timer_args.callback = callback;
+    timer_args.arg = arg;
+    timer_args.dispatch_method = ESP_TIMER_TASK;
+    timer_args.name = name;
+
+    esp_timer_handle_t timer = NULL;
+    esp_timer_create( &timer_args, &timer );
+
+    return timer;
+}
+
+void valveHal_timerOnce(valveHal_timer_t timer, uint64_t us) {
+    esp_timer_start_once( (esp_timer_handle_t) timer, us );
+}
+
+void valveHal_timerPeriodic(valveHal_timer_t timer, uint64_t us) {
+    esp_timer_start_periodic( (esp_timer_handle_t) timer, us );
+}
+
+void valveHal_timerStop(valveHal_timer_t timer) {
+    esp_timer_stop( (esp_timer_handle_t) timer );
+}
+
+valveHal_lock_t valveHal_lockCreate() {
+
+    SemaphoreHandle_t lock = xSemaphoreCreateBinary();
+
+    //Give semaphore after creation to unlock it
+    if( lock != NULL )
+        xSemaphoreGive( lock );
+
+    return lock;
+}
+
+bool valveHal_lockTake(valveHal_lock_t lock, uint32_t timeoutMs) {
+    return xSemaphoreTake( (SemaphoreHandle_t) lock, DELAY_MS(timeoutMs) ) == pdTRUE;
+}
+
+void valveHal_lockGive(valveHal_lock_t lock) {
+    xSemaphoreGive( (SemaphoreHandle_t) lock );
+}
+
+void IRAM_ATTR valveHal_lockGiveFromIsr(valveHal_lock_t lock) {
+
+    BaseType_t woken = pdFALSE;
+    xSemaphoreGiveFromISR( (SemaphoreHandle_t) lock, &woken );
+
+    //Yield at the end of the isr
+    if( woken == pdTRUE )
+        _isrWoken = pdTRUE;
+}
+
+void valveHal_delay(uint32_t ms) {
+    vTaskDelay( DELAY_MS(ms) );
+}
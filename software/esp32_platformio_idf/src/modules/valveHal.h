@@ -0,0 +1,70 @@
+#ifndef VALVEHAL_H
+#define VALVEHAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Hardware abstraction of the valve module: reflex pulse counters, motor, timers and lock.
+
+Implemented by valveHal.cpp on the device and by the valve simulator (sim/) on the host.
+
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//Callback from the counter isr
+typedef void (*valveHal_isr_t)();
+
+//Callback of a timer, runs in task context
+typedef void (*valveHal_timerCallback_t)(void* arg);
+
+typedef void* valveHal_timer_t;
+typedef void* valveHal_lock_t;
+
+//Configure the position counter and the milestone counter, which wraps every VALVE_STALL_PULSES pulses
+void valveHal_counterInit(valveHal_isr_t onTarget, valveHal_isr_t onMilestone);
+//Clear both counters and start counting, onTarget is called when the position counter reaches target (0 = no target)
+void valveHal_counterStart(int16_t target);
+//Stop counting and disable the target, isr safe
+void valveHal_counterStop();
+//Disable the target but keep counting, isr safe
+void valveHal_counterDisarm();
+//Counts since the last start
+int16_t valveHal_counterGet();
+
+//Attach the motor driver with pwm on the enable pin
+void valveHal_motorInit();
+//Start motor in direction with speed in percent
+void valveHal_motorStart(uint8_t direction, uint8_t speed);
+//Change speed of the running motor, task context only
+void valveHal_motorSpeed(uint8_t speed);
+//Stop motor at once, isr safe
+void valveHal_motorStop();
+//Switch reflex light source, isr safe
+void valveHal_reflexEnable(bool enable);
+
+//Microseconds since boot, isr safe
+int64_t valveHal_time();
+//Create a stopped timer
+valveHal_timer_t valveHal_timerCreate(valveHal_timerCallback_t callback, void* arg, const char* name);
+//Start timer once or periodic, the timer must be stopped
+void valveHal_timerOnce(valveHal_timer_t timer, uint64_t us);
+void valveHal_timerPeriodic(valveHal_timer_t timer, uint64_t us);
+void valveHal_timerStop(valveHal_timer_t timer);
+
+//Binary semaphore, given after creation
+valveHal_lock_t valveHal_lockCreate();
+bool valveHal_lockTake(valveHal_lock_t lock, uint32_t timeoutMs);
+void valveHal_lockGive(valveHal_lock_t lock);
+//Give from the counter isr callbacks
+void valveHal_lockGiveFromIsr(valveHal_lock_t lock);
+
+void valveHal_delay(uint32_t ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //VALVEHAL_H
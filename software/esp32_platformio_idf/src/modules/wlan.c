@@ -3,15 +3,89 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
 #include "freertos/task.h"
 #include "esp_wifi.h"
 #include "esp_event_loop.h"
+#include "esp_attr.h"
 #include "esp_log.h"
+#include "lwip/dns.h"
 
 static const char *TAG = "WLAN";
 
+//Connection data of the last wake cycle, kept in rtc ram which will not be cleared by deep-sleep
+typedef struct {
+    bool valid;
+    uint8_t bssid[6];
+    uint8_t channel;
+    tcpip_adapter_ip_info_t ip_info;
+    ip_addr_t dns;
+} wlan_lease_t;
+
+static RTC_DATA_ATTR wlan_lease_t _lease;
+
+//True as long as the cached lease is used for the current connection
+static bool _fastResume = false;
+
+//Fill station config for the access point. Uses the cached BSSID and channel if fast resume is active
+static void wlan_set_sta_config() {
+
+    wifi_config_t wifi_conf = {
+        .sta =  {
+            .ssid = WIFI_SSID,
+            .password = WIFI_PASSWORD,
+        }
+    };
+
+    if( _fastResume ) {
+        //Connect directly to the known access point without scanning all channels
+        wifi_conf.sta.bssid_set = true;
+        memcpy( wifi_conf.sta.bssid, _lease.bssid, sizeof(_lease.bssid) );
+        wifi_conf.sta.channel = _lease.channel;
+    }
+
+    esp_wifi_set_config( ESP_IF_WIFI_STA, &wifi_conf );
+}
+
+//Apply cached ip config statically instead of requesting a lease by dhcp
+static void wlan_apply_lease() {
+
+    tcpip_adapter_dhcpc_stop( TCPIP_ADAPTER_IF_STA );
+    tcpip_adapter_set_ip_info( TCPIP_ADAPTER_IF_STA, &_lease.ip_info );
+    dns_setserver( 0, &_lease.dns );
+}
+
+//Store connection data of the current access point and dhcp lease
+static void wlan_store_lease() {
+
+    wifi_ap_record_t ap;
+
+    if( esp_wifi_sta_get_ap_info( &ap ) != ESP_OK ) {
+        _lease.valid = false;
+        return;
+    }
+
+    memcpy( _lease.bssid, ap.bssid, sizeof(_lease.bssid) );
+    _lease.channel = ap.primary;
+    tcpip_adapter_get_ip_info( TCPIP_ADAPTER_IF_STA, &_lease.ip_info );
+    ip_addr_copy( _lease.dns, *dns_getserver(0) );
+    _lease.valid = true;
+}
+
+//Cached lease failed -> Fall back to full scan and dhcp
+static void wlan_fallback() {
+
+    ESP_LOGW(TAG, "cached lease failed, fall back to scan and dhcp");
+
+    _lease.valid = false;
+    _fastResume = false;
+
+    wlan_set_sta_config();
+    tcpip_adapter_dhcpc_start( TCPIP_ADAPTER_IF_STA );
+}
+
 static esp_err_t event_handler(void *ctx, system_event_t *event)
 {
     switch(event->event_id) {
@@ -20,7 +94,12 @@ static esp_err_t event_handler(void *ctx, system_event_t *event)
         break;
 
     case SYSTEM_EVENT_STA_GOT_IP:
-        ESP_LOGI(TAG, "got ip:%s", ip4addr_ntoa(&event->event_info.got_ip.ip_info.ip));
+        ESP_LOGI(TAG, "got ip:%s (%s) after %u ms", ip4addr_ntoa(&event->event_info.got_ip.ip_info.ip),
+                 _fastResume ? "cached" : "dhcp", esp_log_timestamp());
+
+        if( !_fastResume )
+            wlan_store_lease();
+
         xEventGroupSetBits(wifi_event_group, WIFI_CONNECTED_BIT);
         break;
 
@@ -31,8 +110,10 @@ static esp_err_t event_handler(void *ctx, system_event_t *event)
     case SYSTEM_EVENT_AP_STADISCONNECTED:
         ESP_LOGI(TAG, "station:"MACSTR"leave, AID=%d", MAC2STR(event->event_info.sta_disconnected.mac), event->event_info.sta_disconnected.aid);
         break;
-        
+
     case SYSTEM_EVENT_STA_DISCONNECTED:
+        if( _fastResume )
+            wlan_fallback();
         esp_wifi_connect();
         xEventGroupClearBits(wifi_event_group, WIFI_CONNECTED_BIT);
         break;
@@ -44,7 +125,7 @@ static esp_err_t event_handler(void *ctx, system_event_t *event)
 }
 
 void wlan_init() {
-    
+
     wifi_init_config_t init_conf = WIFI_INIT_CONFIG_DEFAULT();
 
     //Init tcpip stack
@@ -53,6 +134,12 @@ void wlan_init() {
     //set hostname
     tcpip_adapter_set_hostname(TCPIP_ADAPTER_IF_STA, "ESP32-Radiator");
 
+    //Use connection data of the last wake cycle if available
+    _fastResume = WIFI_FAST_RESUME && _lease.valid;
+
+    if( _fastResume )
+        wlan_apply_lease();
+
     //init event loop
     esp_event_loop_init(event_handler, NULL);
 
@@ -67,15 +154,8 @@ void wlan_init() {
 
     //Set country to europe
     esp_wifi_set_country( WIFI_COUNTRY_POLICY_AUTO );
-    
-    wifi_config_t wifi_conf = {
-        .sta =  {
-            .ssid = WIFI_SSID,
-            .password = WIFI_PASSWORD,
-        }
-    };
 
-    esp_wifi_set_config( ESP_IF_WIFI_STA, &wifi_conf );
+    wlan_set_sta_config();
 
     esp_wifi_set_ps( WIFI_PS_MODEM );
 
@@ -83,8 +163,8 @@ void wlan_init() {
     esp_wifi_start();
 
     ESP_LOGI(TAG, "wifi_init_sta finished.");
-    ESP_LOGI(TAG, "connect to ap SSID:%s password:%s",
-             WIFI_SSID, WIFI_PASSWORD);
+    ESP_LOGI(TAG, "connect to ap SSID:%s password:%s (%s)",
+             WIFI_SSID, WIFI_PASSWORD, _fastResume ? "fast resume" : "scan");
 }
 
 uint64_t wlan_get_mac_lsb_first() {
@@ -97,6 +177,19 @@ uint64_t wlan_get_mac_lsb_first() {
     return *( (uint64_t*) mac_swp );
 }
 
+bool wlan_is_fast_resume() {
+    return _fastResume;
+}
+
+void wlan_invalidate_lease() {
+
+    _lease.valid = false;
+
+    //Reconnect with scan and dhcp. The disconnect event will do the fallback
+    if( _fastResume )
+        esp_wifi_disconnect();
+}
+
 void wlan_sleep() {
 
     esp_wifi_stop();
@@ -1,6 +1,7 @@
 #ifndef WLAN_H
 #define WLAN_H
 
+#include <stdbool.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
 
@@ -17,6 +18,12 @@ void wlan_init();
 
 uint64_t wlan_get_mac_lsb_first();
 
+//True if the connection was made with the cached BSSID, channel and IP lease of the last wake cycle
+bool wlan_is_fast_resume();
+
+//Drop the cached lease, e.g. because the broker is not reachable with it. Reconnects with scan and DHCP
+void wlan_invalidate_lease();
+
 void wlan_sleep();
 
 #ifdef __cplusplus
@@ -225,4 +225,6 @@
 #define CONFIG_ESP_MQTT_TASK_STACK_SIZE 4096
 #define CONFIG_ESP_MQTT_TASK_STACK_PRIORITY 5
 #define CONFIG_ESP_MQTT_EVENT_QUEUE_SIZE 64
+#define CONFIG_ESP_MQTT_INFLIGHT_WINDOW 4
+#define CONFIG_ESP_MQTT_RX_BUFFER_SIZE 256
 #define CONFIG_LWIP_SO_RCVBUF 1
\ No newline at end of file
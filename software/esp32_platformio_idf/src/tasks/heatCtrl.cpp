@@ -2,18 +2,82 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
+#include <stdlib.h>
 #include <assert.h>
+#include <math.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
 #include "freertos/semphr.h"
+#include "esp_attr.h"
 #include "esp_log.h"
 #include "board/board.h"
+#include "board/config.h"
 #include "driver/si7020.h"
 #include "modules/valve.h"
+#include "modules/valveCurve.h"
+#include "modules/sleepScheduler.h"
+#include "modules/sampleLog.h"
 #include "tasks/mqttClient.h"
 
 static QueueHandle_t heatTempQueue = NULL;
 
+//Keep last published temperature, target temperature and count of cycles without network in rtc ram, this memory will not be cleared by deep-sleep
+static RTC_DATA_ATTR float _publishedTemp = NAN;
+static RTC_DATA_ATTR float _targetTemp = NAN;
+static RTC_DATA_ATTR uint16_t _silentCycles;
+
+//Failed calibrations in a row of the maintenance, the retries are backed off. Reported by the next network cycle
+static RTC_DATA_ATTR uint8_t _calibrationFailures;
+static RTC_DATA_ATTR uint8_t _reportedFailures;
+static RTC_DATA_ATTR uint16_t _calibrationBackoff; //Cycles till the next attempt
+static RTC_DATA_ATTR uint16_t _calibrationDeferred; //Network cycles a due calibration waited for a cycle without network
+
+//Valve driver is initialized once per wake up, by the heat controller task or the maintenance
+static bool _valveReady;
+
+static void heatController_valveInit() {
+
+    if( !_valveReady ) {
+        valve_init();
+        _valveReady = true;
+    }
+}
+
+//Calculate valve position in 0.1% steps for the given temperatures
+static uint16_t heatController_valveValue( float temperature, float targetTemp ) {
+
+    //Close valve on correct or over-temperature
+    if( temperature >= targetTemp )
+        return 0;
+
+    //Heating effect according to temperature difference - experimental
+    uint32_t effect = (targetTemp - temperature) * 200; //On >=5°C difference, the valve will be opend fully
+    if( effect > VALVE_PERMILLE_MAX )
+        effect = VALVE_PERMILLE_MAX; //Make sure, the valve value will not be greater than 100%
+
+    //Stroke which gives this effect on the learned valve curve
+    return valveCurve_toStroke( effect );
+}
+
+//True if the valve position differs enough from the given value to be worth a motor move
+static bool heatController_valveMoveNeeded( uint16_t valveValue ) {
+
+    uint16_t position = valve_getPermille();
+
+    //Endstops are always approached, they resync the valve position
+    if( valveValue == 0 || valveValue == VALVE_PERMILLE_MAX )
+        return valveValue != position;
+
+    return abs( valveValue - position ) >= HEATCTRL_VALVE_DEADBAND;
+}
+
+//Move valve to the given value, small changes within the deadband are skipped
+static void heatController_setValve( uint16_t valveValue ) {
+
+    if( heatController_valveMoveNeeded( valveValue ) )
+        valve_setPermille( valveValue );
+}
+
 void heatController_task( void* pvParameters ) {
 
     //pvParameters must not be NULL
@@ -25,6 +89,8 @@ void heatController_task( void* pvParameters ) {
     //Create a queue for setting the target temperature 
     heatTempQueue = xQueueCreate( 1, sizeof(float) );
 
+    /* Phase 1: Sense */
+
     //Create instance of SI7020 sensor which measures Temperature and Humidity
     SI7020 sensor( SI7020_ADDR );
     uint8_t serial = sensor.getSerial();
@@ -32,52 +98,97 @@ void heatController_task( void* pvParameters ) {
     //Check connection and correrct sensor id
     if( serial != SI7020::SERIAL_NUMBER) {
         ESP_LOGE( "HEATC", "FAILED: Serial is %d and should %d", serial, SI7020::SERIAL_NUMBER );
-    } else {
-        ESP_LOGD( "HEATC", "Temperature: %2.2f\n", sensor.getTemperature() );
     }
 
+    float temperature = sensor.getTemperature();
+    float humidity = sensor.getHumidity();
+
+    ESP_LOGD( "HEATC", "Temperature: %2.2f", temperature );
+
+    //Use cached target till a new one is received
+    sleepScheduler_setTemperature( temperature, _targetTemp );
+
+    //Valve curve for the controller output
+    valveCurve_init();
+
+    /* Phase 2: Actuate with cached target while the network is coming up */
+
     //Init valve
-    ESP_LOGD( "HEATC", "Valve init\n" );
+    ESP_LOGD( "HEATC", "Valve init" );
     
-    valve_init();
+    heatController_valveInit();
 
-    //Calibrate valve
-    if( valve_calibration() != true ) {
-        ESP_LOGE("HEATC", "Valve calibration failed");
+    //Calibrate valve. A calibrated valve resyncs at the endstops, a due full calibration is done by the maintenance before sleep
+    if( valve_getMaxCounts() == 0 || ( !RADIOLESS_CYCLE && valve_calibrationDue() ) ) {
+        if( valve_calibration() != true ) {
+            ESP_LOGE("HEATC", "Valve calibration failed");
+        }
+    }
+
+    uint16_t lastPosition = valve_getPermille();
+
+    if( !isnan( _targetTemp ) ) {
+        ESP_LOGD( "HEATC", "Regulate to cached target %2.1f", _targetTemp );
+        heatController_setValve( heatController_valveValue( temperature, _targetTemp ) );
     }
 
-    float temperature;
-    float humidity;
+    /* Phase 3: Network */
+
+    //Wait for broker connection
+    if( xEventGroupWaitBits( mqtt_event_group, MQTT_CONNECTED_BIT, false, false, DELAY_MS(HEATCTRL_CONNECT_TIMEOUT_MS) ) & MQTT_CONNECTED_BIT ) {
+
+        mqttClient_pubClimate( temperature, humidity );
+
+        //Upload history of the cycles without network including the current sample
+        sampleLog_add( temperature, humidity, valve_get() );
+        mqttClient_pubSamples();
 
-    //Regulate temperature
-    while( 1 ) {
-        
-        temperature = sensor.getTemperature();
-        humidity = sensor.getHumidity();
+        //Remember published state for the following cycles without network
+        _publishedTemp = temperature;
+        _silentCycles = 0;
 
-        //Wait for target Temperature but max. 10 seconds
+        /* Phase 4: Reconcile */
+
+        //Wait till all retained messages are delivered. Timeout is only a fallback if the broker does not echo the sync request
+        if( !( xEventGroupWaitBits( mqtt_event_group, MQTT_SYNCED_BIT, false, false, DELAY_MS(HEATCTRL_TARGET_TIMEOUT_MS) ) & MQTT_SYNCED_BIT ) ) {
+            ESP_LOGW( "HEATC", "Sync timeout" );
+        }
+
+        //Retained target temperature is already queued if there is one
         float targetTemp = 0;
-        if( xQueueReceive( heatTempQueue, &targetTemp, DELAY_MS(10000) ) == pdTRUE ) {
+        if( xQueueReceive( heatTempQueue, &targetTemp, 0 ) == pdTRUE ) {
             
             ESP_LOGD( "HEATC", "Target temperature set to %2.1f", targetTemp );
 
-            mqttClient_pubTemperature( temperature );
-            mqttClient_pubHumidity( humidity );
-
-            //Regulate
-            if( temperature >= targetTemp ) {
-                valve_set(0); //Close valve on correct or over-temperature
-            } else {
-                //Open valve according to temperature difference - experimental
-                uint16_t valveValue = (targetTemp - temperature) * 20; //On >=5°C difference, the valve will be opend fully
-                valve_set( valveValue > 100 ? 100 : (uint8_t) valveValue ); //Make sure, the valve value will not be greater than 100%
+            //Only a changed target needs a second move
+            if( targetTemp != _targetTemp ) {
+                _targetTemp = targetTemp;
+                heatController_setValve( heatController_valveValue( temperature, targetTemp ) );
             }
+
+            sleepScheduler_setTemperature( temperature, targetTemp );
         }
-        //vTaskDelay( DELAY_MS(10000) );
 
-        //Exit loop
-        break;
+        //Valve position after all moves of this cycle
+        mqttClient_pubValve( valve_getPermille(), valve_getDriftPermille() );
+
+        //Calibrations failed or succeeded again in the cycles without network
+        if( _calibrationFailures != _reportedFailures ) {
+            mqttClient_pubCalibration( _calibrationFailures );
+            _reportedFailures = _calibrationFailures;
+        }
+    } else {
+        ESP_LOGW( "HEATC", "No broker connection" );
+
+        //Keep sample for the next network cycle
+        sampleLog_add( temperature, humidity, valve_get() );
     }
+
+    //Temperature needs some time to follow a valve movement
+    sleepScheduler_setValveSettling( valve_getPermille() != lastPosition );
+
+    //Learn the valve curve from the temperature trend of the stroke since the last cycle
+    valveCurve_observe( temperature, valve_getPermille() );
     
     xTaskNotifyGive( parentTask );
 
@@ -90,6 +201,91 @@ bool setTemperature( float temperature ) {
 
     assert( heatTempQueue );
 
-    //Send new temperature value to task and return true on success
-    return xQueueSend( heatTempQueue, &temperature, 100 );
+    //Send new temperature value to task, a newer value replaces a not yet received one (e.g. config and temperature topic)
+    return xQueueOverwrite( heatTempQueue, &temperature );
+}
+
+bool heatController_needsNetwork() {
+
+    SI7020 sensor( SI7020_ADDR );
+    float temperature = sensor.getTemperature();
+
+    //Use measurement for sleep period in case no network is needed
+    sleepScheduler_setTemperature( temperature, _targetTemp );
+
+    //Valve curve for the controller output
+    valveCurve_init();
+
+    //Nothing published yet or no target temperature known
+    if( isnan( _publishedTemp ) || isnan( _targetTemp ) )
+        return true;
+
+    //Force a network cycle from time to time to receive new targets and show that we are alive
+    if( _silentCycles >= RADIOLESS_MAX_SILENT_CYCLES )
+        return true;
+
+    //Temperature change is worth to be published
+    if( fabsf( temperature - _publishedTemp ) >= RADIOLESS_DEADBAND )
+        return true;
+
+    //Valve has to be moved
+    if( heatController_valveMoveNeeded( heatController_valveValue( temperature, _targetTemp ) ) )
+        return true;
+
+    //User pressed a button
+    if( sleepScheduler_isButtonWake() )
+        return true;
+
+    //Valve keeps its stroke, a due calibration returns to it afterwards
+    valveCurve_observe( temperature, valve_getPermille() );
+
+    _silentCycles++;
+
+    //Keep history for the next network cycle
+    sampleLog_add( temperature, sensor.getHumidity(), valve_get() );
+
+    ESP_LOGD( "HEATC", "No network needed: %2.2f°C, %u silent cycles", temperature, _silentCycles );
+
+    return false;
+}
+
+void heatController_maintenance( bool networkCycle ) {
+
+    if( !valve_calibrationDue() ) {
+        _calibrationDeferred = 0;
+        return;
+    }
+
+    //The stroke takes some seconds, it waits for a cycle without network but not longer than the limit
+    if( networkCycle && RADIOLESS_CYCLE && _calibrationDeferred < RADIOLESS_CALIBRATION_MAX_DEFER ) {
+        _calibrationDeferred++;
+        return;
+    }
+
+    //A failed stroke is not repeated on every wake up, the retries are backed off
+    if( _calibrationBackoff > 0 ) {
+        _calibrationBackoff--;
+        return;
+    }
+
+    heatController_valveInit();
+    uint16_t position = valve_getPermille();
+
+    if( valve_calibration() != true ) {
+
+        if( _calibrationFailures < UINT8_MAX )
+            _calibrationFailures++;
+
+        uint8_t exponent = _calibrationFailures < RADIOLESS_CALIBRATION_BACKOFF ? _calibrationFailures : RADIOLESS_CALIBRATION_BACKOFF;
+        _calibrationBackoff = 1u << exponent;
+
+        ESP_LOGE( "HEATC", "Valve calibration failed %u times, retry in %u cycles", _calibrationFailures, _calibrationBackoff );
+    } else {
+        _calibrationFailures = 0;
+        _calibrationBackoff = 0;
+        _calibrationDeferred = 0;
+
+        //Back to the regulated position
+        valve_setPermille( position );
+    }
 }
\ No newline at end of file
@@ -13,6 +13,13 @@ void heatController_task( void* pvParameters );
 
 bool setTemperature( float temperature );
 
+//Measure temperature and check against last published state. Returns false if this wake cycle can skip the network
+bool heatController_needsNetwork();
+
+//Full valve stroke if a calibration is due, blocks till the valve is back at its position. Call before deep-sleep: it runs in
+//cycles without network, in network cycles only after RADIOLESS_CALIBRATION_MAX_DEFER of them
+void heatController_maintenance( bool networkCycle );
+
 #ifdef __cplusplus
 }
 #endif
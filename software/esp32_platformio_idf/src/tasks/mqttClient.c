@@ -1,16 +1,22 @@
 #include "mqttClient.h"
 #include <stdio.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <string.h>
 #include <assert.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
-#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_attr.h"
 #include "esp_log.h"
+#include "esp_system.h"
 #include "modules/wlan.h"
 #include "modules/valve.h"
+#include "modules/sleepScheduler.h"
+#include "modules/sampleLog.h"
 #include "tasks/heatCtrl.h"
 #include "board/board.h"
+#include "board/config.h"
 
 /* ESP MQTT C++ Directive */
 #ifdef __cplusplus
@@ -23,6 +29,12 @@ extern "C" {
 }
 #endif
 
+//Samples per publish, must fit into the 256 byte mqtt buffer
+#define SAMPLE_BATCH_SIZE 32
+
+//Max. time to upload the sample log
+#define SAMPLE_UPLOAD_TIMEOUT_MS 5000
+
 static const char* pHost;
 static const char* pPort;
 static const char* pUsername;
@@ -31,9 +43,395 @@ static const char* pSubTopic;
 static const char* pPubTopic;
 static char pClientId[13];
 
-static SemaphoreHandle_t mqttSemaphr;
 EventGroupHandle_t mqtt_event_group;
 
+//MQTT client memory is allocated
+static bool _initialized = false;
+
+//Topic names, if they belong to the command (subscription) or status (publication) prefix and if their QoS 0 publish packet is pre-encoded
+static const struct {
+    const char* name;
+    bool command;
+    bool prepared;
+} topicNames[MQTT_TOPIC_COUNT] = {
+    [MQTT_TOPIC_TEMPERATURE] = { TOPIC_TEMPERATURE, false, true },
+    [MQTT_TOPIC_HUMIDITY]    = { TOPIC_HUMIDITY, false, true },
+    [MQTT_TOPIC_VALVE]       = { TOPIC_VALVE, false, true },
+    [MQTT_TOPIC_VALVE_DRIFT] = { TOPIC_VALVE_DRIFT, false, true },
+    [MQTT_TOPIC_VALVE_CALIBRATION] = { TOPIC_VALVE_CALIBRATION, false, false },
+    [MQTT_TOPIC_BATTERY]     = { TOPIC_BATTERY, false, true },
+    [MQTT_TOPIC_SLEEP]       = { TOPIC_SLEEP, false, true },
+    [MQTT_TOPIC_SAMPLES]     = { TOPIC_SAMPLES, false, false },
+    [MQTT_TOPIC_SYNC]        = { TOPIC_SYNC, true, false },
+};
+
+//Full topics "<prefix><client id>/<name>", built once by mqttClient_init
+static char topicBuffer[MQTT_TOPIC_BUFFER_SIZE];
+static lwmqtt_string_t topics[MQTT_TOPIC_COUNT];
+
+//Publish packets with encoded header and topic, publishing only adds the payload and remaining length
+static uint8_t templateBuffer[MQTT_TEMPLATE_BUFFER_SIZE];
+static lwmqtt_publish_template_t templates[MQTT_TOPIC_COUNT];
+static bool templateReady[MQTT_TOPIC_COUNT]; //Template is encoded, else the topic is published without it
+
+//Telemetry value for the publisher task
+typedef struct {
+    mqttClient_topic_t topic;
+    int32_t value;
+    uint8_t decimals;
+    const char* suffix; //String literal published as "value,suffix", NULL if none. Stays valid across deep-sleep
+    uint32_t stamp; //Twice the queue position at enqueue, orders the records of one topic from different producers
+} mqttClient_record_t;
+
+//Cell of the record queue. The sequence tells producers and publisher whose turn it is
+typedef struct {
+    uint32_t sequence;
+    mqttClient_record_t record;
+} mqttClient_cell_t;
+
+//Lock-free queue from any task to the publisher task (bounded multi-producer queue, single consumer)
+static mqttClient_cell_t ring[MQTT_RECORD_QUEUE_SIZE];
+static uint32_t ringHead; //Next position to reserve, shared by all producers
+static uint32_t ringTail; //Next position to read, written by the publisher task only
+static uint32_t flushedPosition; //All records before this position are published
+
+//Latest record per topic which found the queue full, the publisher takes them after the queue
+static mqttClient_record_t overflow[MQTT_TOPIC_COUNT];
+static uint32_t overflowTopics;
+static portMUX_TYPE overflowLock = portMUX_INITIALIZER_UNLOCKED;
+
+//Latest value per topic which is not published yet, publisher task only. Kept in rtc ram, values not published before
+//deep-sleep are published by the next network cycle
+static RTC_DATA_ATTR mqttClient_record_t latest[MQTT_TOPIC_COUNT];
+static RTC_DATA_ATTR uint32_t pendingTopics;
+
+static TaskHandle_t publisherTask;
+
+_Static_assert( MQTT_TEMPLATE_PAYLOAD_SIZE > MQTT_FIXED_SIZE, "payload buffers must hold a formatted value" );
+
+//Format fixed-point value as decimal string without printf, e.g. (215, 1) -> "21.5". Writes up to MQTT_FIXED_SIZE chars,
+//returns the length
+static size_t format_fixed(char* dst, int32_t value, uint8_t decimals) {
+
+    assert( decimals <= MQTT_MAX_DECIMALS );
+
+    char digits[MQTT_FIXED_SIZE];
+    size_t n = 0, len = 0;
+    uint32_t v = value < 0 ? -(uint32_t) value : (uint32_t) value;
+
+    //Digits in reverse order, at least one digit before the decimal point
+    do {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while( v > 0 || n <= decimals );
+
+    if( value < 0 )
+        dst[len++] = '-';
+
+    while( n > 0 ) {
+        dst[len++] = digits[--n];
+        if( n == decimals && n > 0 )
+            dst[len++] = '.';
+    }
+
+    return len;
+}
+
+//Round float to a fixed-point value with the given number of decimals
+static int32_t to_fixed(float value, uint8_t decimals) {
+
+    while( decimals-- > 0 )
+        value *= 10;
+
+    return (int32_t) ( value < 0 ? value - 0.5f : value + 0.5f );
+}
+
+//Build all topics of the table
+static void build_topics() {
+
+    size_t used = 0;
+
+    for( int i = 0; i < MQTT_TOPIC_COUNT; i++ ) {
+
+        int len = snprintf( topicBuffer + used, sizeof(topicBuffer) - used, "%s%s/%s",
+                            topicNames[i].command ? pSubTopic : pPubTopic, pClientId, topicNames[i].name );
+
+        //Topic buffer too small for the configured prefixes
+        assert( len > 0 && used + len < sizeof(topicBuffer) );
+
+        topics[i].data = topicBuffer + used;
+        topics[i].len = len;
+        used += len + 1;
+    }
+}
+
+//Pre-encode the publish packets of the status topics
+static void build_templates() {
+
+    size_t used = 0;
+
+    for( int i = 0; i < MQTT_TOPIC_COUNT; i++ ) {
+
+        templateReady[i] = false;
+
+        if( !topicNames[i].prepared )
+            continue;
+
+        //Fixed header, topic and payload
+        size_t size = LWMQTT_PUBLISH_TEMPLATE_HEADER + 2 + topics[i].len + MQTT_TEMPLATE_PAYLOAD_SIZE;
+
+        //Template buffer too small for the configured prefixes -> Encode the remaining topics on each publish
+        if( used + size > sizeof(templateBuffer) ) {
+            ESP_LOGW("MQTT", "No template space for %s", topicNames[i].name);
+            continue;
+        }
+
+        lwmqtt_err_t err = lwmqtt_prepare_publish( &templates[i], templateBuffer + used, size, topics[i], LWMQTT_QOS0, false );
+        if( err != LWMQTT_SUCCESS ) {
+            ESP_LOGW("MQTT", "Template for %s failed: %d", topicNames[i].name, err);
+            continue;
+        }
+
+        templateReady[i] = true;
+        used += size;
+    }
+}
+
+//Send payload to a topic of the table, if the connection is established
+static bool publish_payload(mqttClient_topic_t topic, uint8_t* payload, size_t len) {
+
+    //Pre-encoded packet for status values, others are encoded completely
+    if( templateReady[topic] && len <= MQTT_TEMPLATE_PAYLOAD_SIZE )
+        return esp_mqtt_publish_prepared( &templates[topic], payload, len );
+
+    return esp_mqtt_publish_topic( topics[topic], payload, len, 0, false );
+}
+
+//Reserve a cell and store the record stamped with its position. Returns false if the publisher has not read the cell of the
+//previous lap yet, then the stamp lies between the records reserved before and the ones reserved later
+static bool ring_push(const mqttClient_record_t* record, uint32_t* stamp) {
+
+    uint32_t position = __atomic_load_n( &ringHead, __ATOMIC_RELAXED );
+    mqttClient_cell_t* cell;
+
+    while( true ) {
+
+        cell = &ring[position & (MQTT_RECORD_QUEUE_SIZE - 1)];
+        int32_t diff = (int32_t) ( __atomic_load_n( &cell->sequence, __ATOMIC_ACQUIRE ) - position );
+
+        if( diff == 0 ) {
+            //Cell is free -> Reserve it, a failed exchange reloads the position
+            if( __atomic_compare_exchange_n( &ringHead, &position, position + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) )
+                break;
+        } else if( diff < 0 ) {
+            //Queue is full, a record reserved later gets this position or a later one
+            *stamp = ( position << 1 ) - 1;
+            return false;
+        } else {
+            //Another producer was faster
+            position = __atomic_load_n( &ringHead, __ATOMIC_RELAXED );
+        }
+    }
+
+    cell->record = *record;
+    cell->record.stamp = position << 1;
+
+    //Hand the cell to the publisher
+    __atomic_store_n( &cell->sequence, position + 1, __ATOMIC_RELEASE );
+
+    return true;
+}
+
+//Store a record as latest value of its topic unless the stored one is newer, publisher task only
+static void latest_update(const mqttClient_record_t* record) {
+
+    mqttClient_record_t* stored = &latest[record->topic];
+
+    //Also a published value is newer, the older one must not be published after it
+    if( (int32_t) ( record->stamp - stored->stamp ) < 0 )
+        return;
+
+    *stored = *record;
+    pendingTopics |= 1u << record->topic;
+}
+
+//Take the next record, publisher task only
+static bool ring_pop(mqttClient_record_t* record) {
+
+    mqttClient_cell_t* cell = &ring[ringTail & (MQTT_RECORD_QUEUE_SIZE - 1)];
+
+    //Not written yet
+    if( __atomic_load_n( &cell->sequence, __ATOMIC_ACQUIRE ) != ringTail + 1 )
+        return false;
+
+    *record = cell->record;
+
+    //Release the cell for the next lap
+    __atomic_store_n( &cell->sequence, ringTail + MQTT_RECORD_QUEUE_SIZE, __ATOMIC_RELEASE );
+    __atomic_store_n( &ringTail, ringTail + 1, __ATOMIC_RELEASE );
+
+    return true;
+}
+
+//Queue is full -> Keep the record in the overflow slot of its topic, replaces an older record of the same topic
+static void overflow_push(const mqttClient_record_t* record, uint32_t stamp) {
+
+    portENTER_CRITICAL( &overflowLock );
+
+    mqttClient_record_t* stored = &overflow[record->topic];
+
+    if( !( overflowTopics & (1u << record->topic) ) || (int32_t) ( stamp - stored->stamp ) >= 0 ) {
+        *stored = *record;
+        stored->stamp = stamp;
+        overflowTopics |= 1u << record->topic;
+    }
+
+    portEXIT_CRITICAL( &overflowLock );
+}
+
+//Move the overflow records to the latest values, publisher task only. A newer record of the topic read from the queue
+//before is kept
+static void overflow_pop() {
+
+    if( __atomic_load_n( &overflowTopics, __ATOMIC_RELAXED ) == 0 )
+        return;
+
+    portENTER_CRITICAL( &overflowLock );
+
+    for( int i = 0; i < MQTT_TOPIC_COUNT; i++ ) {
+        if( overflowTopics & (1u << i) )
+            latest_update( &overflow[i] );
+    }
+
+    overflowTopics = 0;
+
+    portEXIT_CRITICAL( &overflowLock );
+}
+
+//Queue a record and wake up the publisher task
+static bool enqueue(const mqttClient_record_t* record) {
+
+    uint32_t stamp;
+
+    //Queue full -> Coalesce with older records of the topic instead of dropping the newest value
+    if( !ring_push( record, &stamp ) ) {
+        ESP_LOGD("MQTT", "Record queue full, %s coalesced", topicNames[record->topic].name );
+        overflow_push( record, stamp );
+    }
+
+    if( publisherTask != NULL )
+        xTaskNotifyGive( publisherTask );
+
+    return true;
+}
+
+//Format the payload of a record, e.g. "21.5" or "300,idle". Returns the length
+static size_t format_record(char* dst, const mqttClient_record_t* record) {
+
+    size_t len = format_fixed( dst, record->value, record->decimals );
+
+    if( record->suffix != NULL ) {
+        size_t suffixLen = strnlen( record->suffix, MQTT_TEMPLATE_PAYLOAD_SIZE - len - 1 );
+        dst[len++] = ',';
+        memcpy( dst + len, record->suffix, suffixLen );
+        len += suffixLen;
+    }
+
+    return len;
+}
+
+//Publish the pending topics, up to MQTT_BATCH_SIZE values with one socket write. Failed values stay pending
+static void publish_pending() {
+
+    while( pendingTopics != 0 ) {
+
+        char payloads[MQTT_BATCH_SIZE][MQTT_TEMPLATE_PAYLOAD_SIZE];
+        lwmqtt_string_t batchTopics[MQTT_BATCH_SIZE];
+        lwmqtt_message_t messages[MQTT_BATCH_SIZE];
+        mqttClient_topic_t first = MQTT_TOPIC_COUNT;
+        uint32_t batch = 0;
+        int count = 0;
+
+        for( int i = 0; i < MQTT_TOPIC_COUNT && count < MQTT_BATCH_SIZE; i++ ) {
+
+            if( !( pendingTopics & (1u << i) ) )
+                continue;
+
+            messages[count] = (lwmqtt_message_t) lwmqtt_default_message;
+            messages[count].payload = (uint8_t*) payloads[count];
+            messages[count].payload_len = format_record( payloads[count], &latest[i] );
+            batchTopics[count] = topics[i];
+
+            ESP_LOGI("MQTT", "Publish: \"%.*s\" to \"%.*s\"", (int) messages[count].payload_len, payloads[count], topics[i].len, topics[i].data);
+
+            if( count == 0 )
+                first = (mqttClient_topic_t) i;
+
+            batch |= 1u << i;
+            count++;
+        }
+
+        //Single values use the pre-encoded packet
+        bool success = count == 1 ? publish_payload( first, messages[0].payload, messages[0].payload_len )
+                                  : esp_mqtt_publish_batch( count, batchTopics, messages );
+
+        //Retry with the next record or connection
+        if( !success )
+            return;
+
+        pendingTopics &= ~batch;
+    }
+}
+
+//Subscription was granted within the persistent session, kept in rtc ram which will not be cleared by deep-sleep
+static RTC_DATA_ATTR bool subscribed;
+
+//Id of the last sync request, kept in rtc ram which will not be cleared by deep-sleep. An echo of a former wake cycle
+//which is delivered by the persistent session must not pass the barrier of this one
+static RTC_DATA_ATTR uint32_t syncId;
+
+//Send a sync request to our own command topic. Its echo arrives after all retained messages of a new subscription or
+//the messages queued by the kept session
+static void sync_request() {
+
+    //Random start after power up, the broker session may outlive the rtc ram
+    if( syncId == 0 )
+        syncId = esp_random();
+
+    //Positive 31 bit id, never 0
+    syncId = syncId % INT32_MAX + 1;
+
+    char payload[MQTT_FIXED_SIZE];
+    size_t len = format_fixed( payload, (int32_t) syncId, 0 );
+
+    //QoS 1 makes sure the broker has routed the request when the call returns
+    if( !esp_mqtt_publish_topic( topics[MQTT_TOPIC_SYNC], (uint8_t*) payload, len, 1, false ) ) {
+        ESP_LOGE("MQTT", "Sync request failed");
+    }
+}
+
+//Parse config as "key=value;key=value", e.g. "temperature=21.5;sleep=20,300"
+static void parse_config(char* config) {
+
+    char* saveptr = NULL;
+
+    for( char* item = strtok_r( config, ";", &saveptr ); item != NULL; item = strtok_r( NULL, ";", &saveptr ) ) {
+
+        float targetTemp;
+        unsigned int minPeriod, maxPeriod;
+
+        if( sscanf( item, "temperature=%f", &targetTemp ) == 1 ) {
+            ESP_LOGI("MQTT", "Config: target temperature %2.1f°C", targetTemp );
+            setTemperature( targetTemp );
+        } else if( sscanf( item, "sleep=%u,%u", &minPeriod, &maxPeriod ) == 2 ) {
+            ESP_LOGI("MQTT", "Config: sleep period %u-%u s", minPeriod, maxPeriod );
+            sleepScheduler_setLimits( minPeriod, maxPeriod );
+        } else {
+            ESP_LOGW("MQTT", "Config: unknown item \"%s\"", item );
+        }
+    }
+}
+
 static void status_callback(esp_mqtt_status_t status) {
 
     switch (status) {
@@ -43,30 +441,39 @@ static void status_callback(esp_mqtt_status_t status) {
             if(mqtt_event_group != NULL)
                 xEventGroupSetBits( mqtt_event_group, MQTT_CONNECTED_BIT );
 
-            //Release semaphore and allow publishing
-            xSemaphoreGive( mqttSemaphr );
+            //Publish the values queued while disconnected
+            if( publisherTask != NULL )
+                xTaskNotifyGive( publisherTask );
                  
-            //Format subscription topic by concat the topic strings
-            char topic[256];
-            sprintf( topic, "%s%s/#", pSubTopic, pClientId );
-            
-            // subscribe  
-            if( !esp_mqtt_subscribe(topic, 2) ) {
-                ESP_LOGE("MQTT", "Subscription failed");
+            //Session of a former wake cycle with our subscription -> The broker queued the commands published at QoS >= 1
+            //while we slept and delivers them now, subscribing again would only repeat the retained messages
+            if( esp_mqtt_session_present() && subscribed ) {
+                ESP_LOGI("MQTT", "Session present, subscription kept");
             } else {
-                ESP_LOGI("MQTT", "Subscriped to %s", topic);
+                subscribed = false;
+
+                //New session -> The broker sends the retained messages (target temperature, config) in reply to the subscribe
+                char topic[256];
+                sprintf( topic, "%s%s/#", pSubTopic, pClientId );
+
+                if( !esp_mqtt_subscribe(topic, 2) ) {
+                    ESP_LOGE("MQTT", "Subscription failed");
+                } else {
+                    ESP_LOGI("MQTT", "Subscriped to %s", topic);
+                    subscribed = MQTT_PERSISTENT_SESSION;
+                }
             }
 
+            //Barrier for the retained or queued messages
+            sync_request();
+
             break;
 
         case ESP_MQTT_STATUS_DISCONNECTED:
 
             //Clear connected bit in eventgoup
             if(mqtt_event_group != NULL)
-                xEventGroupClearBits( mqtt_event_group, MQTT_CONNECTED_BIT );
-
-            //Take semamphore in case we are not connected anymore
-            xSemaphoreTake( mqttSemaphr, 100 );
+                xEventGroupClearBits( mqtt_event_group, MQTT_CONNECTED_BIT | MQTT_SYNCED_BIT );
 
             // reconnect
             esp_mqtt_start(pHost, pPort, pClientId, pUsername, pPassword);
@@ -75,34 +482,97 @@ static void status_callback(esp_mqtt_status_t status) {
 
 }
 
+//True if the topic ends with the given item, e.g. "/temperature"
+static bool topic_is(const char* topic, size_t topicLen, const char* item) {
+
+    size_t len = strlen(item);
+
+    return topicLen >= len && memcmp( topic + topicLen - len, item, len ) == 0;
+}
+
+//Handle the command topics, shared by the in place and the queued callback. Must not block or publish
+static bool handle_command(const char* topic, size_t topicLen, const char* value) {
+
+    /* Temperature target value for this device */
+    if( topic_is( topic, topicLen, "/" TOPIC_TEMPERATURE ) ) {
+
+        float targetTemp = 0.0;
+
+        if( sscanf( value, "%f", &targetTemp ) == 1 ) {
+            ESP_LOGI("MQTT", "Target temperature set to %2.1f°C", targetTemp );
+            setTemperature( targetTemp );
+        }
+        return true;
+    }
+
+    /* Echo of our sync request -> All retained messages are delivered */
+    if( topic_is( topic, topicLen, "/" TOPIC_SYNC ) ) {
+
+        unsigned int id = 0;
+
+        if( sscanf( value, "%u", &id ) == 1 && id == syncId ) {
+            ESP_LOGI("MQTT", "Synced");
+            xEventGroupSetBits( mqtt_event_group, MQTT_SYNCED_BIT );
+        }
+        return true;
+    }
+
+    /* Sleep period limits for this device */
+    if( topic_is( topic, topicLen, "/" TOPIC_SLEEP ) ) {
+
+        unsigned int minPeriod = 0, maxPeriod = 0;
+
+        if( sscanf( value, "%u,%u", &minPeriod, &maxPeriod ) == 2 ) {
+            ESP_LOGI("MQTT", "Sleep period set to %u-%u s", minPeriod, maxPeriod );
+            sleepScheduler_setLimits( minPeriod, maxPeriod );
+        }
+        return true;
+    }
+
+    //Config and debug topics are handled by the queued callback
+    return false;
+}
+
+//Handle short command payloads directly from the mqtt read buffer
+static bool inplace_callback(lwmqtt_string_t topic, lwmqtt_message_t msg) {
+
+    char value[16];
+
+    //Payload is not null terminated, longer payloads are handled by the queued callback
+    if( msg.payload_len >= sizeof(value) )
+        return false;
+
+    memcpy( value, msg.payload, msg.payload_len );
+    value[msg.payload_len] = 0;
+
+    return handle_command( topic.data, topic.len, value );
+}
+
+//Queued callback for all messages not handled in place, topic and payload are null terminated
 static void message_callback(const char *topic, uint8_t *payload, size_t len) {
 
     ESP_LOGI("MQTT", "incoming: %s => %s (%d)", topic, payload, (int)len);
 
+    /* Command topics with a long payload */
+    if( handle_command( topic, strlen(topic), (char*) payload ) )
+        return;
+
 #if CONFIG_LOG_DEFAULT_LEVEL >= 4 //Only enable this feature for debug log level
     /* Debug options: */
     if( strstr(topic, "/valve") ) {//Topic contains valve position
-        uint valvePosition = 0;
-        //Parse value from string
-        sscanf( (char*) payload, "%u", &valvePosition );
-        ESP_LOGI("MQTT", "Set valve position to %u%%", (uint8_t) valvePosition );
+        float valvePosition = 0;
+        //Parse value from string, 0.1% steps
+        sscanf( (char*) payload, "%f", &valvePosition );
+        ESP_LOGI("MQTT", "Set valve position to %.1f%%", valvePosition );
         //Set valve position
-        if( valve_set( valvePosition ) != true )
+        if( valve_setPermille( valvePosition > 0 ? to_fixed( valvePosition, 1 ) : 0 ) != true )
             ESP_LOGE( "MQTT", "Valve set returned false. Regulation failed" );
     }
 #endif
 
-    /* Temperature target vlaue for this device */
-    if( strstr(topic, "/temperature") ) {//Topic contains led at last elment
-        
-        float targetTemp = 0.0;
-        
-        //Parse temperature value from string
-        sscanf( (char*) payload, "%f", &targetTemp );
-        ESP_LOGI("MQTT", "Target temperature set to %2.1f°C", targetTemp );
-        
-        //Set target temperature
-        setTemperature( targetTemp );
+    /* Retained config for this device */
+    if( strstr(topic, "/" TOPIC_CONFIG) ) {
+        parse_config( (char*) payload );
     }
 
 }
@@ -122,18 +592,35 @@ void mqttClient_init(const char* host, const char* port, const char* username, c
     sprintf( pClientId, "%06llx", wlan_get_mac_lsb_first() );
     ESP_LOGI("MQTT", "Client id is: %s", pClientId);
 
-    //Create mutex
-    mqttSemaphr = xSemaphoreCreateMutex();
+    //Precompute all topics and status packets, publishing only needs to format the payload
+    build_topics();
+    build_templates();
+
+    //Cells of the first lap are free
+    for( int i = 0; i < MQTT_RECORD_QUEUE_SIZE; i++ )
+        ring[i].sequence = i;
+
+    //Stamps restart with the queue, values still pending from the last cycle are older than all new records
+    for( int i = 0; i < MQTT_TOPIC_COUNT; i++ )
+        latest[i].stamp = 0;
 
     //Create eventgroup
     if( mqtt_event_group == NULL )
         mqtt_event_group = xEventGroupCreate();
 
-    //Take sempahore because mqtt connection is not established
-    xSemaphoreTake( mqttSemaphr, 100 );
-
     //Init the MQTT client
-    esp_mqtt_init(status_callback, message_callback, 256, 2000); //Was 1000ms
+    _initialized = esp_mqtt_init(status_callback, message_callback, 256, 2000); //Was 1000ms
+
+    if( !_initialized ) {
+        ESP_LOGE("MQTT", "Client init failed");
+        return;
+    }
+
+    //Keep session on broker to skip the subscription on wake up
+    esp_mqtt_session( MQTT_PERSISTENT_SESSION );
+
+    //Handle command topics without copy and queue
+    esp_mqtt_inplace( inplace_callback );
 
 }
 
@@ -142,6 +629,12 @@ void mqttClient_task( void* pvParameters  ) {
     //Check for existing event group
     assert( wifi_event_group );
 
+    //No memory for the client -> Run without broker, the heat controller times out
+    if( !_initialized ) {
+        vTaskDelete( NULL );
+        return;
+    }
+
     //Task loop for stopping and starting mqtt client according to WiFi state
     while(1) {
 
@@ -150,8 +643,15 @@ void mqttClient_task( void* pvParameters  ) {
             {} //Wait for wifi connection
 
         //Start mqtt client process
-        esp_mqtt_start( pHost, pPort, pClientId, pUsername, pPassword );   
-        
+        esp_mqtt_start( pHost, pPort, pClientId, pUsername, pPassword );
+
+        //A cached lease may be outdated (e.g. address given to another client) -> Fall back to dhcp if broker is not reachable
+        if( wlan_is_fast_resume() &&
+            !( xEventGroupWaitBits( mqtt_event_group, MQTT_CONNECTED_BIT, false, false, DELAY_MS(WIFI_FAST_RESUME_TIMEOUT_MS) ) & MQTT_CONNECTED_BIT ) ) {
+            ESP_LOGW("MQTT", "Broker not reachable with cached lease");
+            wlan_invalidate_lease();
+        }
+
         //loop, as long as a wifi connection is established
         while( xEventGroupGetBits(wifi_event_group) & WIFI_CONNECTED_BIT ) {
             vTaskDelay( 1000/portTICK_RATE_MS );
@@ -162,95 +662,181 @@ void mqttClient_task( void* pvParameters  ) {
     }
 }
     
-void mqttClient_pubTemperature(float temperature) {
+void mqttClient_publisherTask( void* pvParameters ) {
+
+    publisherTask = xTaskGetCurrentTaskHandle();
+
+    while(1) {
+
+        //Wait for new records or the connection, retry failed values regularly
+        ulTaskNotifyTake( pdTRUE, DELAY_MS(1000) );
+
+        //Keep only the latest value per topic
+        mqttClient_record_t record;
+        while( ring_pop( &record ) )
+            latest_update( &record );
+
+        //Records which found the queue full, the stamps keep the newer value of a topic
+        overflow_pop();
 
-    //Publish only if semaphore is available
-    if( xSemaphoreTake( mqttSemaphr, 10) == pdTRUE ) {
-        char topic[256];
-        char payload[10];
-       
-        //Format topic by concat the topic strings
-        sprintf( topic, "%s%s/%s", pPubTopic, pClientId, TOPIC_TEMPERATURE );
-        
-        //Format payload from float to string
-        sprintf( payload, "%2.1f", temperature );
-
-        ESP_LOGI("MQTT", "Publish: \"%s\" to \"%s\"", payload, topic);
-        
-        //Send MQTT Message
-        esp_mqtt_publish( topic, (uint8_t*) payload, strlen(payload), 0, false );
-
-        //Release semaphore
-        xSemaphoreGive( mqttSemaphr );
+        //Values stay pending till the broker is connected
+        if( pendingTopics != 0 && ( xEventGroupGetBits( mqtt_event_group ) & MQTT_CONNECTED_BIT ) )
+            publish_pending();
+
+        //All records read so far are published
+        if( pendingTopics == 0 && __atomic_load_n( &overflowTopics, __ATOMIC_RELAXED ) == 0 )
+            __atomic_store_n( &flushedPosition, ringTail, __ATOMIC_RELEASE );
     }
 }
 
-void mqttClient_pubHumidity(float humidity) {
+bool mqttClient_publish(mqttClient_topic_t topic, int32_t value, uint8_t decimals) {
 
-    //Publish only if semaphore is available
-    if( xSemaphoreTake( mqttSemaphr, 10) == pdTRUE ) {
-        char topic[256];
-        char payload[10];
-       
-        //Format topic by concat the topic strings
-        sprintf( topic, "%s%s/%s", pPubTopic, pClientId, TOPIC_HUMIDITY );
-        
-        //Format payload from float to string
-        sprintf( payload, "%2.1f", humidity );
-
-        ESP_LOGI("MQTT", "Publish: \"%s\" to \"%s\"", payload, topic);
-        
-        //Send MQTT Message
-        esp_mqtt_publish( topic, (uint8_t*) payload, strlen(payload), 0, false );
-
-        //Release semaphore
-        xSemaphoreGive( mqttSemaphr );
+    //More decimals than digits of the value would overflow the payload buffers
+    if( decimals > MQTT_MAX_DECIMALS ) {
+        ESP_LOGE("MQTT", "%u decimals for %s not supported", decimals, topicNames[topic].name );
+        return false;
     }
+
+    const mqttClient_record_t record = { topic, value, decimals, NULL };
+
+    return enqueue( &record );
+}
+
+bool mqttClient_publishValues(const mqttClient_value_t* values, int count) {
+
+    bool success = true;
+
+    for( int i = 0; i < count; i++ )
+        success &= mqttClient_publish( values[i].topic, values[i].value, values[i].decimals );
+
+    return success;
 }
 
-void mqttClient_pubValve(uint8_t percent) {
+bool mqttClient_flush(uint32_t timeoutMs) {
+
+    //Records reserved up to now, the publisher can not pass a reserved record before it is written
+    uint32_t target = __atomic_load_n( &ringHead, __ATOMIC_ACQUIRE );
+    TickType_t start = xTaskGetTickCount();
+
+    while( (int32_t) ( __atomic_load_n( &flushedPosition, __ATOMIC_ACQUIRE ) - target ) < 0 ) {
 
-    //Publish only if semaphore is available
-    if( xSemaphoreTake( mqttSemaphr, 10) == pdTRUE ) {
-        char topic[256];
-        char payload[10];
-       
-        //Format topic by concat the topic strings
-        sprintf( topic, "%s%s/%s", pPubTopic, pClientId, TOPIC_VALVE );
-        
-        //Format payload from float to string
-        sprintf( payload, "%u", percent );
+        if( xTaskGetTickCount() - start > DELAY_MS(timeoutMs) )
+            return false;
 
-        ESP_LOGI("MQTT", "Publish: \"%s\" to \"%s\"", payload, topic);
-        
-        //Send MQTT Message
-        esp_mqtt_publish( topic, (uint8_t*) payload, strlen(payload), 0, false );
+        //Not connected -> Only wait till the publisher has read the records, they stay pending in rtc ram
+        if( !( xEventGroupGetBits( mqtt_event_group ) & MQTT_CONNECTED_BIT ) && (int32_t) ( __atomic_load_n( &ringTail, __ATOMIC_ACQUIRE ) - target ) >= 0 )
+            return false;
 
-        //Release semaphore
-        xSemaphoreGive( mqttSemaphr );
+        vTaskDelay( 1 );
     }
+
+    return true;
+}
+
+void mqttClient_pubTemperature(float temperature) {
+    mqttClient_publish( MQTT_TOPIC_TEMPERATURE, to_fixed( temperature, 1 ), 1 );
+}
+
+void mqttClient_pubHumidity(float humidity) {
+    mqttClient_publish( MQTT_TOPIC_HUMIDITY, to_fixed( humidity, 1 ), 1 );
+}
+
+void mqttClient_pubClimate(float temperature, float humidity) {
+
+    const mqttClient_value_t values[] = {
+        { MQTT_TOPIC_TEMPERATURE, to_fixed( temperature, 1 ), 1 },
+        { MQTT_TOPIC_HUMIDITY, to_fixed( humidity, 1 ), 1 },
+    };
+
+    mqttClient_publishValues( values, 2 );
+}
+
+void mqttClient_pubValve(uint16_t permille, uint16_t driftPermille) {
+
+    const mqttClient_value_t values[] = {
+        { MQTT_TOPIC_VALVE, permille, 1 },
+        { MQTT_TOPIC_VALVE_DRIFT, driftPermille, 1 },
+    };
+
+    mqttClient_publishValues( values, 2 );
+}
+
+void mqttClient_pubCalibration(uint8_t failures) {
+    mqttClient_publish( MQTT_TOPIC_VALVE_CALIBRATION, failures, 0 );
 }
 
 void mqttClient_pubBattery(float voltage) {
-    
-    //Publish only if semaphore is available
-    if( xSemaphoreTake( mqttSemaphr, 10) == pdTRUE ) {
-        char topic[256];
-        char payload[10];
-       
-        //Format topic by concat the topic strings
-        sprintf( topic, "%s%s/%s", pPubTopic, pClientId, TOPIC_BATTERY );
-        
-        //Format payload from float to string
-        sprintf( payload, "%2.1f", voltage );
-
-        ESP_LOGI("MQTT", "Publish: \"%s\" to \"%s\"", payload, topic);
-        
-        //Send MQTT Message
-        esp_mqtt_publish( topic, (uint8_t*) payload, strlen(payload), 0, false );
-
-        //Release semaphore
-        xSemaphoreGive( mqttSemaphr );
+    mqttClient_publish( MQTT_TOPIC_BATTERY, to_fixed( voltage, 1 ), 1 );
+}
+
+void mqttClient_pubSleep(uint32_t period, const char* reason) {
+
+    //Published as "period,reason"
+    const mqttClient_record_t record = { MQTT_TOPIC_SLEEP, (int32_t) period, 0, reason };
+
+    enqueue( &record );
+}
+
+void mqttClient_pubSamples() {
+
+    //Header: uint16 count, uint32 age of first sample in seconds (little endian), followed by the samples
+    uint8_t payload[6 + SAMPLE_BATCH_SIZE * sizeof(sampleLog_entry_t)];
+
+    //Sample counts of the batches in flight, oldest first
+    uint16_t batches[CONFIG_ESP_MQTT_INFLIGHT_WINDOW];
+    int inflight = 0;
+    uint16_t sent = 0;
+
+    uint32_t completed = esp_mqtt_completed();
+    TickType_t start = xTaskGetTickCount();
+
+    //Samples stay in the log till the next connection
+    if( !( xEventGroupGetBits( mqtt_event_group ) & MQTT_CONNECTED_BIT ) )
+        return;
+
+    //Upload oldest samples first, keep up to a window of batches in flight instead of waiting for each ack
+    while( true ) {
+
+        //Drop samples of the acked batches, acks arrive in order
+        while( inflight > 0 && esp_mqtt_completed() != completed ) {
+            completed++;
+            sampleLog_drop( batches[0] );
+            sent -= batches[0];
+            memmove( batches, batches + 1, --inflight * sizeof(batches[0]) );
+        }
+
+        //All samples acked
+        if( inflight == 0 && sent >= sampleLog_count() )
+            break;
+
+        //Keep unacked samples for next network cycle
+        if( xTaskGetTickCount() - start > DELAY_MS(SAMPLE_UPLOAD_TIMEOUT_MS) || !(xEventGroupGetBits( mqtt_event_group ) & MQTT_CONNECTED_BIT) ) {
+            ESP_LOGW("MQTT", "Sample upload incomplete, %u samples left", sampleLog_count());
+            break;
+        }
+
+        //Window full or all samples sent -> Wait for acks
+        if( inflight == CONFIG_ESP_MQTT_INFLIGHT_WINDOW || sent >= sampleLog_count() ) {
+            vTaskDelay( 1 );
+            continue;
+        }
+
+        uint32_t age = sampleLog_age( sent );
+        uint16_t count = sampleLog_peek( sent, (sampleLog_entry_t*) (payload + 6), SAMPLE_BATCH_SIZE );
+
+        memcpy( payload, &count, sizeof(count) );
+        memcpy( payload + 2, &age, sizeof(age) );
+
+        ESP_LOGI("MQTT", "Publish: %u samples to \"%.*s\"", count, topics[MQTT_TOPIC_SAMPLES].len, topics[MQTT_TOPIC_SAMPLES].data);
+
+        //QoS 1, samples are only dropped after the broker has acked them
+        if( !esp_mqtt_publish_async( topics[MQTT_TOPIC_SAMPLES], payload, 6 + count * sizeof(sampleLog_entry_t), 1, false ) ) {
+            vTaskDelay( 1 );
+            continue;
+        }
+
+        batches[inflight++] = count;
+        sent += count;
     }
 
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 #define MQTTCLIENT_H
 
 #include <stdint.h>
+#include <stdbool.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
 
@@ -17,29 +18,106 @@ knxgateway1/status/Kitchen/Lights/Front Left
 #define TOPIC_TEMPERATURE "temperature"
 #define TOPIC_HUMIDITY "humidity"
 #define TOPIC_VALVE "valve"
+#define TOPIC_VALVE_DRIFT "valveDrift"
+#define TOPIC_VALVE_CALIBRATION "valveCalibration"
 #define TOPIC_BATTERY "battery"
+#define TOPIC_SLEEP "sleep"
+#define TOPIC_SAMPLES "samples"
+
+#define TOPIC_CONFIG "config"
+#define TOPIC_SYNC "sync"
+
+//Size of the buffer for all precomputed topics
+#define MQTT_TOPIC_BUFFER_SIZE 384
+
+//Size of the buffer for the pre-encoded publish packets of the status topics
+#define MQTT_TEMPLATE_BUFFER_SIZE 512
+
+//Max. payload of a pre-encoded publish packet
+#define MQTT_TEMPLATE_PAYLOAD_SIZE 32
+
+//Max. decimals of a fixed-point value, an int32 has 10 digits
+#define MQTT_MAX_DECIMALS 9
+
+//Max. length of a formatted fixed-point value: sign, 10 digits and the decimal point
+#define MQTT_FIXED_SIZE 12
+
+//Max. number of values published with one socket write
+#define MQTT_BATCH_SIZE 4
+
+//Records in the queue to the publisher task, must be a power of two
+#define MQTT_RECORD_QUEUE_SIZE 16
 
 #define MQTT_CONNECTED_BIT 0x01
+#define MQTT_SYNCED_BIT 0x02 //All retained or queued command messages are delivered
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+//Ids of the topics in the topic table
+typedef enum {
+    MQTT_TOPIC_TEMPERATURE = 0,
+    MQTT_TOPIC_HUMIDITY,
+    MQTT_TOPIC_VALVE,
+    MQTT_TOPIC_VALVE_DRIFT,
+    MQTT_TOPIC_VALVE_CALIBRATION,
+    MQTT_TOPIC_BATTERY,
+    MQTT_TOPIC_SLEEP,
+    MQTT_TOPIC_SAMPLES,
+    MQTT_TOPIC_SYNC,
+    MQTT_TOPIC_COUNT
+} mqttClient_topic_t;
+
+//Fixed-point value for a topic of the topic table
+typedef struct {
+    mqttClient_topic_t topic;
+    int32_t value;
+    uint8_t decimals;
+} mqttClient_value_t;
+
 extern EventGroupHandle_t wifi_event_group;
 extern EventGroupHandle_t mqtt_event_group;
 
 void mqttClient_init(const char* host, const char* port, const char* username, const char* password, const char* pub_topic_prefix, const char* sub_topic_prefix);
 
 void mqttClient_task(void* pvParameters);
-    
+
+//Publishes the queued values, only the latest value per topic is sent. Values are kept till the broker is connected
+void mqttClient_publisherTask(void* pvParameters);
+
+//Queue a fixed-point value with up to MQTT_MAX_DECIMALS decimals, e.g. (215, 1) -> "21.5". Never blocks or drops the value, a full
+//queue keeps only the latest value per topic. Values not published before deep-sleep are published by the next network cycle.
+//False if there are more decimals
+bool mqttClient_publish(mqttClient_topic_t topic, int32_t value, uint8_t decimals);
+
+//Queue multiple values, the publisher task sends up to MQTT_BATCH_SIZE pending values with one socket write
+bool mqttClient_publishValues(const mqttClient_value_t* values, int count);
+
+//Wait till all values queued before are published. False on timeout or if the broker is not connected, then the values stay
+//pending for the next network cycle
+bool mqttClient_flush(uint32_t timeoutMs);
+
 void mqttClient_pubTemperature(float temperature);
 
 void mqttClient_pubHumidity(float humidity);
 
-void mqttClient_pubValve(uint8_t percent);
+//Publish temperature and humidity with one socket write
+void mqttClient_pubClimate(float temperature, float humidity);
+
+//Publish valve position and its estimated drift, both in 0.1% steps, with one socket write
+void mqttClient_pubValve(uint16_t permille, uint16_t driftPermille);
+
+//Publish the count of failed valve calibrations in a row, 0 after a successful one
+void mqttClient_pubCalibration(uint8_t failures);
 
 void mqttClient_pubBattery(float voltage);
 
+//Reason must be a static string, it is published later by the publisher task
+void mqttClient_pubSleep(uint32_t period, const char* reason);
+
+void mqttClient_pubSamples();
+
 #ifdef __cplusplus
 }
 #endif